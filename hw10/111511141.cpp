@@ -1,10 +1,14 @@
+#include <algorithm>
 #include <cmath>
 #include <fstream>
 #include <iomanip>
 #include <iostream>
+#include <sstream>
 #include <string>
 #include <vector>
 
+#include "csv.h"
+
 using namespace std;
 
 struct OptionData {
@@ -21,6 +25,14 @@ struct OptionData {
     int index_flag;
     string issuer;
     char exercise_style;
+    double index_price;  // 報價日或之前最近的現貨收盤價，沒有則為 NAN
+    double future_price; // 同上，期貨收盤價
+};
+
+// 價格檔的一列，日期轉成 YYYY-MM-DD 以便和選擇權日期比較
+struct PriceRow {
+    string date;
+    double price;
 };
 
 const double r = 0.01844;      // 年利率
@@ -38,72 +50,64 @@ double transaction_cost(int num_index, int num_future, int num_option) {
            num_option * option_point;
 }
 
+// 讀取整個價格檔，依日期由舊到新排序
+bool read_price_history(const string& filename, vector<PriceRow>& history) {
+    ifstream file(filename);
+    if (!file.is_open()) {
+        cout << "Error: 無法開啟檔案 " << filename << endl;
+        return false;
+    }
+
+    // 整個檔案一次讀進來，交給 csv.h 拆欄位
+    // [0:Date, 1:Price, 2:Open, 3:High, 4:Low, 5:Vol., 6:Change %]
+    string text((istreambuf_iterator<char>(file)), istreambuf_iterator<char>());
+    CsvReader reader(text.data(), text.size());
+    vector<string_view> tokens;
+    reader.next(tokens); // 跳過標題行
+    while (reader.next(tokens)) {
+        double price;
+        if (tokens.size() < 2 || tokens[0].size() != 10 ||
+            !parseCsvNumber(tokens[1], price)) // 價格可含千分位逗號
+            continue;
+
+        // 11/03/2020 -> 2020-11-03
+        string_view d = tokens[0];
+        string date = string(d.substr(6, 4)) + "-" + string(d.substr(0, 2)) +
+                      "-" + string(d.substr(3, 2));
+        history.push_back({date, price});
+    }
+    sort(history.begin(), history.end(),
+         [](const PriceRow& a, const PriceRow& b) { return a.date < b.date; });
+    return true;
+}
+
+// as-of 合併：options 已依日期排序，和價格歷史一起往前走，
+// 每筆選擇權取報價日當天或之前最近的收盤價
+void join_as_of(vector<OptionData>& options, const vector<PriceRow>& history,
+                double OptionData::*field) {
+    size_t k = 0;
+    for (auto& opt : options) {
+        while (k < history.size() && history[k].date <= opt.date) k++;
+        opt.*field = k > 0 ? history[k - 1].price : NAN;
+    }
+}
+
 int main() {
     // 1. 讀取 S&P 500 Historical Data.csv
     // Date	Price	Open	High	Low	Vol.	Change %
     // 11/03/2020	3,369.20	3,336.20	3,389.50	3,336.20		1.78%
     string filename1 = "S&P 500 Historical Data.csv";
-    ifstream index_file(filename1);
-
-    if (!index_file.is_open()) {
-        cout << "Error: 無法開啟檔案 " << filename1 << endl;
-        return 1;
-    }
-
     cout << "Reading index data from " << filename1 << endl;
-    string header_index;
-    getline(index_file, header_index); // 跳過標題行
-    string line_index;
-    getline(index_file, line_index);
-    vector<string> tokens_index; // [0:Date, 1:Price, 2:Open, 3:High, 4:Low,
-                                 // 5:Vol., 6:Change %]
-    while (!line_index.empty()) {
-        // 處理引號包裹的欄位
-        size_t end_quote = line_index.find('"', 1);
-        string token;
-        if (end_quote != string::npos) {
-            token = line_index.substr(1, end_quote - 1); // 提取引號內的內容
-            // cout << "Token: " << token << endl;
-            tokens_index.push_back(token);
-            line_index.erase(0, end_quote + 2); // 移除引號和逗號
-        } else {
-            // 引號未閉合，報錯或跳過
-            break;
-        }
-    }
+    vector<PriceRow> index_history;
+    if (!read_price_history(filename1, index_history)) return 1;
 
     // 2. 讀取 S&P 500 Futures Historical Data.csv
     // Date	Price	Open	High	Low	Vol.	Change %
     // 11/03/2020	3,361.50	3,304.00	3,382.75 3,301.25	1.66M	1.85%
     string filename2 = "S&P 500 Futures Historical Data.csv";
-    ifstream future_file(filename2);
-
-    if (!future_file.is_open()) {
-        cout << "Error: 無法開啟檔案 " << filename2 << endl;
-        return 1;
-    }
-
     cout << "Reading futures data from " << filename2 << endl;
-    string header_future;
-    getline(future_file, header_future); // 跳過標題行
-    string line_future;
-    getline(future_file, line_future); // [0:Date, 1:Price, 2:Open, 3:High,
-                                       // 4:Low, 5:Vol., 6:Change %]
-    vector<string> tokens_future;
-    while (!line_future.empty()) {
-        // 處理引號包裹的欄位
-        size_t end_quote = line_future.find('"', 1);
-        string token;
-        if (end_quote != string::npos) {
-            token = line_future.substr(1, end_quote - 1); // 提取引號內的內容
-            // cout << "Token: " << token << endl;
-            tokens_future.push_back(token);
-            line_future.erase(0, end_quote + 2); // 移除引號和逗號
-        } else {
-            // 引號未閉合，報錯或跳過
-            break;
-        }
-    }
+    vector<PriceRow> future_history;
+    if (!read_price_history(filename2, future_history)) return 1;
 
     // 3. 讀取 wrds-www.wharton.upenn.edu.txt
     // secid	date	exdate	last_date	cp_flag	strike_price	best_bid
@@ -150,6 +154,23 @@ int main() {
         options.push_back(data);
     }
 
+    // 4. 每筆選擇權對上當時的現貨與期貨價格
+    stable_sort(options.begin(), options.end(),
+                [](const OptionData& a, const OptionData& b) {
+                    return a.date < b.date;
+                });
+    join_as_of(options, index_history, &OptionData::index_price);
+    join_as_of(options, future_history, &OptionData::future_price);
+    size_t joined = count_if(options.begin(), options.end(),
+                             [](const OptionData& opt) {
+                                 return !isnan(opt.index_price) &&
+                                        !isnan(opt.future_price);
+                             });
+    cout << "Joined " << joined << " of " << options.size()
+         << " options with index and futures prices ("
+         << index_history.size() << " and " << future_history.size()
+         << " days)" << endl;
+
     // 測試輸出解析後的資料
     // int cnt = 0;
     // for (const auto& opt : options) {
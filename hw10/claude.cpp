@@ -1,19 +1,53 @@
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+#if defined(SCANNER_PROFILE) && (defined(__x86_64__) || defined(__i386__))
+#include <x86intrin.h>
+#endif
+
 #include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <charconv>
+#include <chrono>
+#include <cstdint>
 #include <cmath>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
 #include <fstream>
 #include <iomanip>
 #include <iostream>
 #include <map>
+#include <mutex>
 #include <sstream>
 #include <string>
+#include <string_view>
+#include <thread>
 #include <unordered_map>
 #include <vector>
 
+#include "csv.h"
+#include "output_pipeline.h"
+#include "request_server.h"
+#include "splitmix64.h"
+
 using namespace std;
 
 // Constants
-const double r = 0.01844;      // Annual risk-free rate (1.844%)
-const double T = 31.0 / 365.0; // Time to maturity (1 month = 31 days)
+const double r = 0.01844; // Annual risk-free rate (1.844%)
+const double days_per_year = 365.0;
 
 // Point values
 const double index_point_value = 1.0; // Each point for S&P 500 index worth $1
@@ -27,36 +61,1848 @@ const double index_transaction_cost = 1.0 * index_point_value;   // $1
 const double future_transaction_cost = 1.0 * future_point_value; // $250
 const double option_transaction_cost = 1.0 * option_point_value; // $100
 
+// Profiling ///////////////////////////////////////////////////////////////
+// Build with -DSCANNER_PROFILE to time every stage with the CPU tick counter
+// and count rows, pairs and hits. The report goes to the file named by
+// $SCANNER_PROFILE_OUT (default scanner_profile.json); a .prom name selects
+// the Prometheus text format. Without the flag the macros expand to nothing.
+#ifdef SCANNER_PROFILE
+
+enum ProfileStage {
+    STAGE_LOAD_MARKET,
+    STAGE_LOAD_OPTIONS,
+    STAGE_PAIR,
+    STAGE_GROUP,
+    STAGE_SCAN_GROUP, // one sample per expiry group
+    STAGE_DISPLAY,
+    STAGE_IV_EXPIRY, // one sample per expiry
+    STAGE_STREAM_UPDATE,
+    STAGE_MC_EXPIRY,     // European options of one expiry
+    STAGE_MC_AMERICAN,   // one Longstaff-Schwartz option
+    STAGE_SERVE_REQUEST, // one request on a batch thread
+    STAGE_COUNT
+};
+const char* const stage_names[STAGE_COUNT] = {
+    "load_market", "load_options",  "pair",       "group",
+    "scan_group",  "display",       "iv_expiry",  "stream_update",
+    "mc_expiry",   "mc_american",   "serve_request",
+};
+
+enum ProfileCounter {
+    ROWS_PARSED,
+    ROWS_REJECTED,
+    PAIRS_CHECKED,
+    HITS,
+    COUNTER_COUNT
+};
+const char* const counter_names[COUNTER_COUNT] = {
+    "rows_parsed", "rows_rejected", "pairs_checked", "hits"};
+
+inline uint64_t readTicks() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#elif defined(__aarch64__)
+    uint64_t ticks;
+    asm volatile("mrs %0, cntvct_el0" : "=r"(ticks));
+    return ticks;
+#else
+    return chrono::steady_clock::now().time_since_epoch().count();
+#endif
+}
+
+// Lock-free counters and power-of-two tick histograms, shared by threads
+class Profiler {
+   public:
+    static const int BUCKETS = 48;
+
+    Profiler()
+        : start_ticks(readTicks()), start_time(chrono::steady_clock::now()) {}
+
+    void count(ProfileCounter counter, uint64_t n) {
+        counters[counter].fetch_add(n, memory_order_relaxed);
+    }
+
+    void record(ProfileStage stage, uint64_t ticks) {
+        int bucket = ticks ? 64 - __builtin_clzll(ticks) : 0;
+        stages[stage].buckets[min(bucket, BUCKETS - 1)].fetch_add(
+            1, memory_order_relaxed);
+        stages[stage].calls.fetch_add(1, memory_order_relaxed);
+        stages[stage].ticks.fetch_add(ticks, memory_order_relaxed);
+        uint64_t seen = stages[stage].max_ticks.load(memory_order_relaxed);
+        while (ticks > seen && !stages[stage].max_ticks.compare_exchange_weak(
+                                   seen, ticks, memory_order_relaxed)) {
+        }
+    }
+
+    void write() const {
+        const char* env = getenv("SCANNER_PROFILE_OUT");
+        string filename = env ? env : "scanner_profile.json";
+        ofstream file(filename);
+        if (!file.is_open()) {
+            cout << "Error: Cannot open " << filename << endl;
+            return;
+        }
+
+        // Calibrate ticks against the wall clock over the whole run
+        double seconds = chrono::duration<double>(
+                             chrono::steady_clock::now() - start_time)
+                             .count();
+        double tick = seconds / max<uint64_t>(1, readTicks() - start_ticks);
+        bool prometheus =
+            filename.size() >= 5 &&
+            filename.compare(filename.size() - 5, 5, ".prom") == 0;
+        if (prometheus) {
+            writePrometheus(file, tick);
+        } else {
+            writeJson(file, tick);
+        }
+    }
+
+   private:
+    struct Stage {
+        atomic<uint64_t> calls{0}, ticks{0}, max_ticks{0};
+        atomic<uint64_t> buckets[BUCKETS] = {};
+    };
+    atomic<uint64_t> counters[COUNTER_COUNT] = {};
+    Stage stages[STAGE_COUNT];
+    uint64_t start_ticks;
+    chrono::steady_clock::time_point start_time;
+
+    void writeJson(ostream& os, double tick) const {
+        os << "{\n  \"counters\": {";
+        for (int c = 0; c < COUNTER_COUNT; c++) {
+            os << (c ? ", " : "") << '"' << counter_names[c]
+               << "\": " << counters[c].load();
+        }
+        os << "},\n  \"stages\": {";
+        for (int s = 0; s < STAGE_COUNT; s++) {
+            const Stage& st = stages[s];
+            os << (s ? "," : "") << "\n    \"" << stage_names[s]
+               << "\": {\"calls\": " << st.calls.load()
+               << ", \"seconds\": " << st.ticks.load() * tick
+               << ", \"max_seconds\": " << st.max_ticks.load() * tick
+               << ", \"histogram\": [";
+            bool first = true;
+            for (int b = 0; b < BUCKETS; b++) {
+                if (st.buckets[b].load() == 0) continue;
+                os << (first ? "" : ", ") << "{\"le_seconds\": "
+                   << (1ull << b) * tick
+                   << ", \"count\": " << st.buckets[b].load() << "}";
+                first = false;
+            }
+            os << "]}";
+        }
+        os << "\n  }\n}\n";
+    }
+
+    void writePrometheus(ostream& os, double tick) const {
+        for (int c = 0; c < COUNTER_COUNT; c++) {
+            os << "# TYPE scanner_" << counter_names[c] << "_total counter\n"
+               << "scanner_" << counter_names[c] << "_total "
+               << counters[c].load() << "\n";
+        }
+        os << "# TYPE scanner_stage_seconds histogram\n";
+        for (int s = 0; s < STAGE_COUNT; s++) {
+            const Stage& st = stages[s];
+            uint64_t cumulative = 0;
+            for (int b = 0; b < BUCKETS; b++) {
+                if (st.buckets[b].load() == 0) continue;
+                cumulative += st.buckets[b].load();
+                os << "scanner_stage_seconds_bucket{stage=\"" << stage_names[s]
+                   << "\",le=\"" << (1ull << b) * tick << "\"} " << cumulative
+                   << "\n";
+            }
+            os << "scanner_stage_seconds_bucket{stage=\"" << stage_names[s]
+               << "\",le=\"+Inf\"} " << st.calls.load() << "\n"
+               << "scanner_stage_seconds_sum{stage=\"" << stage_names[s]
+               << "\"} " << st.ticks.load() * tick << "\n"
+               << "scanner_stage_seconds_count{stage=\"" << stage_names[s]
+               << "\"} " << st.calls.load() << "\n";
+        }
+    }
+};
+
+Profiler profiler;
+
+// Records the lifetime of the enclosing scope as one sample of a stage
+struct StageTimer {
+    ProfileStage stage;
+    uint64_t start = readTicks();
+    explicit StageTimer(ProfileStage s) : stage(s) {}
+    ~StageTimer() { profiler.record(stage, readTicks() - start); }
+};
+
+// Writes the report when main() returns
+struct ProfileReport {
+    ~ProfileReport() { profiler.write(); }
+};
+
+#define PROFILE_CONCAT_(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_(a, b)
+#define PROFILE_STAGE(stage) \
+    StageTimer PROFILE_CONCAT(stage_timer_, __LINE__)(stage)
+#define PROFILE_COUNT(counter, n) profiler.count(counter, n)
+#define PROFILE_REPORT() ProfileReport profile_report
+
+#else
+
+#define PROFILE_STAGE(stage)
+#define PROFILE_COUNT(counter, n)
+#define PROFILE_REPORT()
+
+#endif
+
 struct MarketData {
     double index_bid = 0, index_ask = 0;
     double future_bid = 0, future_ask = 0;
     bool has_index = false, has_future = false;
 };
 
+// The price files only have closes; bid and ask are synthesized around them
+const double index_half_spread = 0.001;    // 0.1%
+const double futures_half_spread = 0.0005; // 0.05%
+
+// Daily closes of a price file, ascending by day
+struct PriceHistory {
+    vector<int> day; // days since 1970-01-01
+    vector<double> close;
+
+    bool empty() const { return day.empty(); }
+
+    // Latest close at or before target. cursor counts the closes already
+    // passed, so a caller visiting days in increasing order merges with the
+    // history in one forward pass.
+    bool asOf(int target, size_t& cursor, double& price) const {
+        if (cursor > 0 && day[cursor - 1] > target) cursor = 0;
+        while (cursor < day.size() && day[cursor] <= target) cursor++;
+        if (cursor == 0) return false;
+        price = close[cursor - 1];
+        return true;
+    }
+
+    // asOf()'s cursor for a single lookup: the closes at or before target
+    size_t cursorAt(int target) const {
+        return upper_bound(day.begin(), day.end(), target) - day.begin();
+    }
+
+    void sortByDay() {
+        vector<uint32_t> order(day.size());
+        for (uint32_t i = 0; i < order.size(); i++) order[i] = i;
+        stable_sort(order.begin(), order.end(),
+                    [&](uint32_t a, uint32_t b) { return day[a] < day[b]; });
+        PriceHistory sorted;
+        for (uint32_t i : order) {
+            sorted.day.push_back(day[i]);
+            sorted.close.push_back(close[i]);
+        }
+        *this = move(sorted);
+    }
+};
+
+// Index and futures histories of one underlying
+struct MarketHistory {
+    PriceHistory index, futures;
+
+    // Quotes as of a day; the cursors are PriceHistory::asOf()'s
+    MarketData quotesAt(int day, size_t& index_at, size_t& futures_at) const {
+        MarketData quotes;
+        double price;
+        if (index.asOf(day, index_at, price)) {
+            quotes.index_bid = price * (1 - index_half_spread);
+            quotes.index_ask = price * (1 + index_half_spread);
+            quotes.has_index = true;
+        }
+        if (futures.asOf(day, futures_at, price)) {
+            quotes.future_bid = price * (1 - futures_half_spread);
+            quotes.future_ask = price * (1 + futures_half_spread);
+            quotes.has_future = true;
+        }
+        return quotes;
+    }
+
+    // One-off lookup by binary search
+    MarketData quotesAt(int day) const {
+        size_t index_at = index.cursorAt(day);
+        size_t futures_at = futures.cursorAt(day);
+        return quotesAt(day, index_at, futures_at);
+    }
+};
+
+// Fixed-point price: a count of 1/Scale units in four bytes, so equal
+// prices compare and hash exactly. value() is only called where a
+// formula needs a double.
+template <int Scale>
+struct Ticks {
+    int32_t count;
+
+    double value() const { return count / double(Scale); }
+    bool operator==(Ticks other) const { return count == other.count; }
+    bool operator!=(Ticks other) const { return count != other.count; }
+    bool operator<(Ticks other) const { return count < other.count; }
+};
+typedef Ticks<1000> StrikeTicks; // the file's strike_price, strike * 1000
+typedef Ticks<100> QuoteTicks;   // cents
+
+// Days since 1970-01-01, through 2149
+typedef uint16_t DaySerial;
+
+// One options row with every field an integer code: 30 bytes, against
+// the 70 of string_views into the file plus the mapped file itself
 struct OptionData {
-    string option_id;
-    string date;
+    uint32_t option_id;
+    DaySerial date;
     char cp_flag;        // 'C' for Call, 'P' for Put
-    char exercise_style; // 'E' for European
-    string exdate;
-    double strike;
-    double best_bid;
-    double best_offer;
+    char exercise_style; // 'E' for European, 'A' for American
+    uint32_t secid;      // underlying security
+    DaySerial exdate;
+    StrikeTicks strike;
+    QuoteTicks best_bid;
+    QuoteTicks best_offer;
     int volume;
 };
 
+// Struct-of-arrays option chain, one entry per loaded row
+struct OptionChain {
+    vector<uint32_t> option_id;
+    vector<DaySerial> date, exdate;
+    vector<char> cp_flag, exercise_style;
+    vector<uint32_t> secid;
+    vector<StrikeTicks> strike;
+    vector<QuoteTicks> best_bid, best_offer;
+    vector<int> volume;
+
+    size_t size() const { return strike.size(); }
+    bool empty() const { return strike.empty(); }
+
+    void reserve(size_t n) {
+        option_id.reserve(n);
+        date.reserve(n);
+        exdate.reserve(n);
+        cp_flag.reserve(n);
+        exercise_style.reserve(n);
+        secid.reserve(n);
+        strike.reserve(n);
+        best_bid.reserve(n);
+        best_offer.reserve(n);
+        volume.reserve(n);
+    }
+
+    void push_back(const OptionData& opt) {
+        option_id.push_back(opt.option_id);
+        date.push_back(opt.date);
+        exdate.push_back(opt.exdate);
+        cp_flag.push_back(opt.cp_flag);
+        exercise_style.push_back(opt.exercise_style);
+        secid.push_back(opt.secid);
+        strike.push_back(opt.strike);
+        best_bid.push_back(opt.best_bid);
+        best_offer.push_back(opt.best_offer);
+        volume.push_back(opt.volume);
+    }
+
+    void append(const OptionChain& other) {
+        option_id.insert(option_id.end(), other.option_id.begin(),
+                         other.option_id.end());
+        date.insert(date.end(), other.date.begin(), other.date.end());
+        exdate.insert(exdate.end(), other.exdate.begin(), other.exdate.end());
+        cp_flag.insert(cp_flag.end(), other.cp_flag.begin(),
+                       other.cp_flag.end());
+        exercise_style.insert(exercise_style.end(),
+                              other.exercise_style.begin(),
+                              other.exercise_style.end());
+        secid.insert(secid.end(), other.secid.begin(), other.secid.end());
+        strike.insert(strike.end(), other.strike.begin(), other.strike.end());
+        best_bid.insert(best_bid.end(), other.best_bid.begin(),
+                        other.best_bid.end());
+        best_offer.insert(best_offer.end(), other.best_offer.begin(),
+                          other.best_offer.end());
+        volume.insert(volume.end(), other.volume.begin(), other.volume.end());
+    }
+};
+
+// Call and put rows (indices into OptionChain) of the same contract series
+struct OptionPair {
+    uint32_t call, put;
+};
+
+// Stable LSD radix passes over order by key(row), one byte per pass.
+// Bytes that hold the same value in every key are skipped.
+template <class Key>
+void radixSortRows(vector<uint32_t>& order, vector<uint32_t>& next, Key key) {
+    size_t n = order.size();
+    if (n < 2) return;
+    uint64_t first = key(order[0]), varying = 0;
+    for (size_t i = 1; i < n; i++) varying |= key(order[i]) ^ first;
+
+    next.resize(n);
+    for (int shift = 0; shift < 64; shift += 8) {
+        if (!(varying >> shift & 0xff)) continue;
+        size_t start[257] = {0};
+        for (size_t i = 0; i < n; i++)
+            start[(key(order[i]) >> shift & 0xff) + 1]++;
+        for (int b = 0; b < 256; b++) start[b + 1] += start[b];
+        for (size_t i = 0; i < n; i++)
+            next[start[key(order[i]) >> shift & 0xff]++] = order[i];
+        order.swap(next);
+    }
+}
+
+// Sort row indices by (secid, exercise_style, date, exdate, strike,
+// cp_flag) and emit one call/put pair per series in a single pass. Every
+// field is an integer, so the sort is three radix sorts from the least
+// significant key up; a one-day, one-underlying chain only pays passes
+// over the bytes of its strikes and expiries. Ties keep file order, so
+// the first call and first put of a series are paired.
+void pairCallsAndPuts(const OptionChain& chain, vector<uint32_t>& order,
+                      vector<OptionPair>& pairs) {
+    order.resize(chain.size());
+    for (uint32_t i = 0; i < order.size(); i++) order[i] = i;
+    vector<uint32_t> next;
+    radixSortRows(order, next, [&](uint32_t row) {
+        uint32_t strike = uint32_t(chain.strike[row].count) ^ 0x80000000u;
+        return uint64_t(strike) << 8 | uint8_t(chain.cp_flag[row]);
+    });
+    radixSortRows(order, next, [&](uint32_t row) {
+        return uint64_t(uint8_t(chain.exercise_style[row])) << 32 |
+               uint64_t(chain.date[row]) << 16 | chain.exdate[row];
+    });
+    radixSortRows(order, next,
+                  [&](uint32_t row) { return uint64_t(chain.secid[row]); });
+
+    auto same_series = [&](uint32_t a, uint32_t b) {
+        return chain.strike[a] == chain.strike[b] &&
+               chain.exdate[a] == chain.exdate[b] &&
+               chain.date[a] == chain.date[b] &&
+               chain.secid[a] == chain.secid[b] &&
+               chain.exercise_style[a] == chain.exercise_style[b];
+    };
+
+    pairs.clear();
+    for (size_t i = 0; i < order.size();) {
+        uint32_t first = order[i];
+        size_t end = i + 1;
+        while (end < order.size() && same_series(order[end], first)) end++;
+
+        // 'C' sorts before 'P', so a call can only be at the run start
+        if (chain.cp_flag[first] == 'C') {
+            for (size_t j = i + 1; j < end; j++) {
+                if (chain.cp_flag[order[j]] == 'P') {
+                    pairs.push_back({first, order[j]});
+                    break;
+                }
+            }
+        }
+        i = end;
+    }
+}
+
+// Strategies the scanner reports, the first four in ParityFlag bit order
+enum Strategy : uint8_t {
+    PARITY_LONG_CALL_STRATEGY,
+    PARITY_SHORT_CALL_STRATEGY,
+    FUTURES_PARITY_LONG_CALL_STRATEGY,
+    FUTURES_PARITY_SHORT_CALL_STRATEGY,
+    CALL_SPREAD_STRATEGY,   // legs: lower call, higher call
+    PUT_SPREAD_STRATEGY,    // legs: lower put, higher put
+    CALL_VERTICAL_STRATEGY, // legs: lower call, higher call
+    PUT_VERTICAL_STRATEGY,  // legs: lower put, higher put
+    LONG_BOX_STRATEGY,      // legs: lower call, higher call, lower put,
+    SHORT_BOX_STRATEGY,     //       higher put
+    CALL_BUTTERFLY_STRATEGY, // legs: lower wing, body, higher wing
+    PUT_BUTTERFLY_STRATEGY,
+    AMERICAN_PARITY_LONG_CALL_STRATEGY, // legs: call, put
+    AMERICAN_PARITY_SHORT_CALL_STRATEGY,
+    CALL_EXERCISE_STRATEGY, // legs: the option
+    PUT_EXERCISE_STRATEGY,
+    STRATEGY_COUNT
+};
+const char* const strategy_names[STRATEGY_COUNT] = {
+    "Put-Call Parity: Long Call + Short Put + Short Index",
+    "Put-Call Parity: Short Call + Long Put + Long Index",
+    "Put-Call-Futures Parity: Long Call + Short Put + Short Future",
+    "Put-Call-Futures Parity: Short Call + Long Put + Long Future",
+    "Call Monotonicity: Long Lower Call + Short Higher Call",
+    "Put Monotonicity: Long Higher Put + Short Lower Put",
+    "Call Vertical Bound: Short Lower Call + Long Higher Call",
+    "Put Vertical Bound: Short Higher Put + Long Lower Put",
+    "Box Spread: Long Call Spread + Long Put Spread",
+    "Box Spread: Short Call Spread + Short Put Spread",
+    "Call Butterfly: Long Wings + Short Body",
+    "Put Butterfly: Long Wings + Short Body",
+    "American Parity: Long Call + Short Put + Short Index",
+    "American Parity: Short Call + Long Put + Long Index",
+    "Early Exercise: Long Call + Exercise + Short Index",
+    "Early Exercise: Long Put + Exercise + Long Index",
+};
+
+// Fixed-size hit record; the details text is only built for shown rows
 struct ArbitrageOpportunity {
-    string strategy;
+    Strategy strategy;
+    uint32_t group;  // ExpiryGroup index
+    uint32_t leg[4]; // option rows; call and put for the parity strategies
     double profit;
-    double strike;
-    string details;
+    StrikeTicks strike;
+    uint32_t secid;
+};
+
+// Higher profit first; ties broken by position so the ranking does not
+// depend on the order in which threads found the hits
+inline bool betterOpportunity(const ArbitrageOpportunity& a,
+                              const ArbitrageOpportunity& b) {
+    if (a.profit != b.profit) return a.profit > b.profit;
+    if (a.group != b.group) return a.group < b.group;
+    if (a.strategy != b.strategy) return a.strategy < b.strategy;
+    return a.leg[0] < b.leg[0];
+}
+
+// Book key: a strike of one underlying
+struct StrikeKey {
+    uint32_t secid;
+    StrikeTicks strike;
+
+    bool operator==(const StrikeKey& other) const {
+        return secid == other.secid && strike == other.strike;
+    }
+};
+
+struct StrikeKeyHash {
+    size_t operator()(const StrikeKey& key) const {
+        return hash<uint64_t>()(uint64_t(key.secid) << 32 |
+                                uint32_t(key.strike.count));
+    }
+};
+
+// Best hit per strike. Hits are folded in as they are found, so memory is
+// bounded by the number of strikes however many hits a session produces.
+class OpportunityBook {
+   public:
+    uint64_t hits = 0;
+
+    bool empty() const { return best_by_strike.empty(); }
+
+    void add(const ArbitrageOpportunity& opp) {
+        hits++;
+        StrikeKey key = {opp.secid, opp.strike};
+        auto [it, added] = best_by_strike.emplace(key, opp);
+        if (!added && betterOpportunity(opp, it->second)) it->second = opp;
+    }
+
+    void merge(const OpportunityBook& other) {
+        uint64_t total = hits + other.hits;
+        for (const auto& [strike, opp] : other.best_by_strike) add(opp);
+        hits = total;
+    }
+
+    // The k most profitable strikes through a bounded heap, by underlying
+    // and strike
+    vector<ArbitrageOpportunity> top(size_t k) const {
+        vector<ArbitrageOpportunity> heap; // worst of the kept on top
+        heap.reserve(k + 1);
+        for (const auto& [strike, opp] : best_by_strike) {
+            if (heap.size() == k && !betterOpportunity(opp, heap.front()))
+                continue;
+            heap.push_back(opp);
+            push_heap(heap.begin(), heap.end(), betterOpportunity);
+            if (heap.size() > k) {
+                pop_heap(heap.begin(), heap.end(), betterOpportunity);
+                heap.pop_back();
+            }
+        }
+        sort(heap.begin(), heap.end(),
+             [](const ArbitrageOpportunity& a, const ArbitrageOpportunity& b) {
+                 if (a.secid != b.secid) return a.secid < b.secid;
+                 return a.strike < b.strike;
+             });
+        return heap;
+    }
+
+   private:
+    unordered_map<StrikeKey, ArbitrageOpportunity, StrikeKeyHash>
+        best_by_strike;
+};
+
+const size_t max_displayed_opportunities = 50;
+
+// Read-only memory mapping of a whole file
+struct MappedFile {
+    const char* data = nullptr;
+    size_t size = 0;
+
+    MappedFile() = default;
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    ~MappedFile() { unmap(); }
+
+    bool map(const string& filename) {
+        unmap();
+        int fd = open(filename.c_str(), O_RDONLY);
+        if (fd < 0) return false;
+
+        struct stat st;
+        if (fstat(fd, &st) == 0 && st.st_size > 0) {
+            void* addr =
+                mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (addr != MAP_FAILED) {
+                madvise(addr, st.st_size, MADV_SEQUENTIAL);
+                data = static_cast<const char*>(addr);
+                size = st.st_size;
+            }
+        }
+        close(fd);
+        return data != nullptr;
+    }
+
+    void unmap() {
+        if (data) munmap(const_cast<char*>(data), size);
+        data = nullptr;
+        size = 0;
+    }
+};
+
+// A rejected row of the options file
+struct ParseError {
+    size_t line;        // 1-based line number in the file
+    const char* reason; // static string, never freed
+};
+
+// Output of one parser thread; line numbers are local until merged
+struct OptionsChunk {
+    OptionChain options;
+    vector<ParseError> errors;
+    size_t lines = 0;
+};
+
+const int OPTION_FIELDS = 11;             // columns used by loadOptionsData()
+const size_t MIN_PARSE_CHUNK = 1 << 20;   // bytes per parser thread
+const int MAX_REPORTED_PARSE_ERRORS = 5;
+
+// Trim surrounding blanks and parse the whole field, no exceptions
+template <class T>
+bool parseNumber(string_view field, T& value) {
+    while (!field.empty() && field.front() == ' ') field.remove_prefix(1);
+    while (!field.empty() && field.back() == ' ') field.remove_suffix(1);
+    const char* end = field.data() + field.size();
+    auto [ptr, ec] = from_chars(field.data(), end, value);
+    return ec == errc() && ptr == end;
+}
+
+// The same, rounded to the nearest tick; false if that overflows
+template <int Scale>
+bool parseNumber(string_view field, Ticks<Scale>& value) {
+    double number;
+    if (!parseNumber(field, number)) return false;
+    double count = nearbyint(number * Scale);
+    if (!(fabs(count) <= INT32_MAX)) return false;
+    value.count = int32_t(count);
+    return true;
+}
+
+// Days since 1970-01-01 of a civil date
+int daysFromCivil(int y, int m, int d) {
+    y -= m <= 2;
+    int era = (y >= 0 ? y : y - 399) / 400;
+    int yoe = y - era * 400;
+    int doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+    int doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return era * 146097 + doe - 719468;
+}
+
+// Days since 1970-01-01 for a "YYYY-MM-DD" field, -1 if malformed
+int parseDaySerial(string_view text) {
+    int y, m, d;
+    if (text.size() != 10 || text[4] != '-' || text[7] != '-' ||
+        !parseNumber(text.substr(0, 4), y) ||
+        !parseNumber(text.substr(5, 2), m) ||
+        !parseNumber(text.substr(8, 2), d) || m < 1 || m > 12)
+        return -1;
+    return daysFromCivil(y, m, d);
+}
+
+// The same for the "MM/DD/YYYY" dates of the price files
+int parseUsDaySerial(string_view text) {
+    int y, m, d;
+    if (text.size() != 10 || text[2] != '/' || text[5] != '/' ||
+        !parseNumber(text.substr(0, 2), m) ||
+        !parseNumber(text.substr(3, 2), d) ||
+        !parseNumber(text.substr(6, 4), y) || m < 1 || m > 12)
+        return -1;
+    return daysFromCivil(y, m, d);
+}
+
+// Parse the lines in [begin, end); fields are split in place, nothing copied
+void parseOptionsChunk(const char* begin, const char* end, bool has_header,
+                       OptionsChunk& chunk) {
+    string_view fields[OPTION_FIELDS];
+
+    for (const char* line = begin; line < end;) {
+        const char* eol =
+            static_cast<const char*>(memchr(line, '\n', end - line));
+        if (!eol) eol = end;
+        const char* next = eol + 1;
+        if (eol > line && eol[-1] == '\r') eol--;
+        chunk.lines++;
+
+        bool header = has_header && chunk.lines == 1 &&
+                      !(line < eol && isdigit((unsigned char)*line));
+        if (line == eol || *line == '#' || header) {
+            line = next; // Skip comments, empty lines and the header
+            continue;
+        }
+
+        int count = 0;
+        for (const char* field = line; count < OPTION_FIELDS;) {
+            const char* tab =
+                static_cast<const char*>(memchr(field, '\t', eol - field));
+            fields[count++] = string_view(field, (tab ? tab : eol) - field);
+            if (!tab) break;
+            field = tab + 1;
+        }
+        line = next;
+
+        if (count < OPTION_FIELDS) {
+            chunk.errors.push_back({chunk.lines, "too few fields"});
+            continue;
+        }
+        if (fields[2].empty() || fields[3].empty()) {
+            chunk.errors.push_back({chunk.lines, "empty flag field"});
+            continue;
+        }
+
+        OptionData opt;
+        opt.cp_flag = fields[2][0];
+        opt.exercise_style = fields[3][0];
+        int date = parseDaySerial(fields[1]);
+        int exdate = parseDaySerial(fields[5]);
+        if (date < 0 || date > UINT16_MAX || exdate < 0 ||
+            exdate > UINT16_MAX) {
+            chunk.errors.push_back({chunk.lines, "invalid date"});
+            continue;
+        }
+        opt.date = DaySerial(date);
+        opt.exdate = DaySerial(exdate);
+        // strike_price is already in StrikeTicks, quotes are rounded to cents
+        if (!parseNumber(fields[0], opt.option_id) ||
+            !parseNumber(fields[4], opt.secid) ||
+            !parseNumber(fields[10], opt.strike.count) ||
+            !parseNumber(fields[8], opt.best_bid) ||
+            !parseNumber(fields[9], opt.best_offer) ||
+            !parseNumber(fields[7], opt.volume)) {
+            chunk.errors.push_back({chunk.lines, "invalid number"});
+            continue;
+        }
+
+        // Only include European and American options with valid bid/ask
+        if ((opt.exercise_style == 'E' || opt.exercise_style == 'A') &&
+            opt.best_bid.count > 0 && opt.best_offer.count > 0) {
+            chunk.options.push_back(opt);
+        }
+    }
+}
+
+// Pairs [begin, end) share an underlying, an exercise style, a quote date
+// and an expiry, so they share T and the discount factor
+struct ExpiryGroup {
+    size_t begin, end;
+    uint32_t secid;
+    bool american;
+    int day;        // quote date, days since 1970-01-01
+    int expiry_day;
+    double T;    // Time to maturity in years
+    double disc; // e^(-rT)
+    const MarketData* market; // as-of quotes of the underlying, see
+                              // ArbitrageScanner::joinMarketData()
+};
+
+// Per-worker copy of one group's quotes, sorted by strike, in
+// parityKernel() layout
+struct GroupScratch {
+    vector<double> K, call_bid, call_ask, put_bid, put_ask;
+    vector<uint64_t> bits;
+    vector<uint32_t> hull; // lower convex hull for the butterfly scan
 };
 
+// Split the sorted pairs into (secid, exercise_style, date, exdate) runs
+// and price each run once
+void groupByExpiry(const OptionChain& chain, const vector<OptionPair>& pairs,
+                   vector<ExpiryGroup>& groups) {
+    groups.clear();
+    for (size_t i = 0; i < pairs.size();) {
+        uint32_t first = pairs[i].call;
+        size_t end = i + 1;
+        while (end < pairs.size() &&
+               chain.exdate[pairs[end].call] == chain.exdate[first] &&
+               chain.date[pairs[end].call] == chain.date[first] &&
+               chain.secid[pairs[end].call] == chain.secid[first] &&
+               chain.exercise_style[pairs[end].call] ==
+                   chain.exercise_style[first]) {
+            end++;
+        }
+
+        ExpiryGroup group;
+        group.begin = i;
+        group.end = end;
+        group.secid = chain.secid[first];
+        group.american = chain.exercise_style[first] == 'A';
+        group.day = chain.date[first];
+        group.expiry_day = chain.exdate[first];
+        if (group.expiry_day >= group.day) {
+            group.T = (group.expiry_day - group.day) / days_per_year;
+            group.disc = exp(-r * group.T);
+            groups.push_back(group);
+        }
+        i = end;
+    }
+}
+
+// Fixed set of workers with one task deque each. Owners pop from the back
+// and idle workers steal from the front of the others, so a worker seeded
+// with a large underlying sheds its groups to the rest. All tasks are
+// pushed before run(), so a worker that finds every deque empty is done.
+class WorkStealingPool {
+   public:
+    explicit WorkStealingPool(size_t workers)
+        : queues(max<size_t>(1, workers)) {}
+
+    size_t size() const { return queues.size(); }
+
+    void push(size_t worker, size_t task) {
+        queues[worker % queues.size()].tasks.push_back(task);
+    }
+
+    // Call task(worker, id) for every pushed id, worker 0 on this thread
+    template <typename Task>
+    void run(Task task) {
+        auto work = [&](size_t w) {
+            for (size_t id; pop(w, id) || steal(w, id);) task(w, id);
+        };
+        vector<thread> threads;
+        for (size_t w = 1; w < queues.size(); w++) {
+            threads.emplace_back(work, w);
+        }
+        work(0);
+        for (auto& t : threads) t.join();
+    }
+
+   private:
+    struct Queue {
+        mutex lock;
+        deque<size_t> tasks;
+    };
+    vector<Queue> queues;
+
+    bool pop(size_t w, size_t& id) {
+        lock_guard<mutex> guard(queues[w].lock);
+        if (queues[w].tasks.empty()) return false;
+        id = queues[w].tasks.back();
+        queues[w].tasks.pop_back();
+        return true;
+    }
+
+    bool steal(size_t w, size_t& id) {
+        for (size_t i = 1; i < queues.size(); i++) {
+            Queue& victim = queues[(w + i) % queues.size()];
+            lock_guard<mutex> guard(victim.lock);
+            if (victim.tasks.empty()) continue;
+            id = victim.tasks.front();
+            victim.tasks.pop_front();
+            return true;
+        }
+        return false;
+    }
+};
+
+// Parity kernel ///////////////////////////////////////////////////////////
+
+// Parity checks of one strike, one bit each
+enum ParityFlag : uint8_t {
+    PARITY_LONG_CALL = 1,          // Long Call + Short Put + Short Index
+    PARITY_SHORT_CALL = 2,         // Short Call + Long Put + Long Index
+    FUTURES_PARITY_LONG_CALL = 4,  // Long Call + Short Put + Short Future
+    FUTURES_PARITY_SHORT_CALL = 8, // Short Call + Long Put + Long Future
+};
+const int PARITY_CHECKS = 4;
+
+// Round-trip costs in option points, as in the scan functions
+const double parity_cost_points =
+    (index_transaction_cost + 2 * option_transaction_cost) /
+    option_point_value;
+const double futures_parity_cost_points =
+    (future_transaction_cost + 2 * option_transaction_cost) /
+    option_point_value;
+
+// Same conditions as scanPutCallParity() and scanPutCallFuturesParity(),
+// without branches. K is the scaled strike; a missing quote or an unloaded
+// S or F is NaN and fails every comparison.
+inline uint8_t parityFlags(double K, double disc, double S, double F,
+                           double call_bid, double call_ask, double put_bid,
+                           double put_ask) {
+    double spot_theory = S - K * disc;
+    double futures_theory = F * disc - K * disc;
+    double high = call_ask - put_bid; // C_ask - P_bid
+    double low = call_bid - put_ask;  // C_bid - P_ask
+    return (spot_theory - low > parity_cost_points) |
+           (high - spot_theory > parity_cost_points) << 1 |
+           (high - futures_theory > futures_parity_cost_points) << 2 |
+           (futures_theory - low > futures_parity_cost_points) << 3;
+}
+
+// Words of parity bits for n strikes: PARITY_CHECKS per 64 strikes
+inline size_t parityWords(size_t n) { return (n + 63) / 64 * PARITY_CHECKS; }
+
+// Evaluate every parity check for n strikes stored as contiguous arrays.
+// Bit i % 64 of bits[i / 64 * PARITY_CHECKS + c] is set when strike i fails
+// check c, so callers only look at the strikes that need materializing.
+void parityKernel(size_t n, const double* K, const double* call_bid,
+                  const double* call_ask, const double* put_bid,
+                  const double* put_ask, double disc, double S, double F,
+                  uint64_t* bits) {
+    fill(bits, bits + parityWords(n), 0);
+    size_t i = 0;
+#if defined(__AVX2__)
+    const __m256d vS = _mm256_set1_pd(S), vFd = _mm256_set1_pd(F * disc);
+    const __m256d vdisc = _mm256_set1_pd(disc);
+    const __m256d vcost = _mm256_set1_pd(parity_cost_points);
+    const __m256d vfcost = _mm256_set1_pd(futures_parity_cost_points);
+    for (; i + 4 <= n; i += 4) {
+        __m256d Kd = _mm256_mul_pd(_mm256_loadu_pd(K + i), vdisc);
+        __m256d spot = _mm256_sub_pd(vS, Kd);
+        __m256d futures = _mm256_sub_pd(vFd, Kd);
+        __m256d high = _mm256_sub_pd(_mm256_loadu_pd(call_ask + i),
+                                     _mm256_loadu_pd(put_bid + i));
+        __m256d low = _mm256_sub_pd(_mm256_loadu_pd(call_bid + i),
+                                    _mm256_loadu_pd(put_ask + i));
+        uint64_t m0 = _mm256_movemask_pd(
+            _mm256_cmp_pd(_mm256_sub_pd(spot, low), vcost, _CMP_GT_OQ));
+        uint64_t m1 = _mm256_movemask_pd(
+            _mm256_cmp_pd(_mm256_sub_pd(high, spot), vcost, _CMP_GT_OQ));
+        uint64_t m2 = _mm256_movemask_pd(
+            _mm256_cmp_pd(_mm256_sub_pd(high, futures), vfcost, _CMP_GT_OQ));
+        uint64_t m3 = _mm256_movemask_pd(
+            _mm256_cmp_pd(_mm256_sub_pd(futures, low), vfcost, _CMP_GT_OQ));
+        uint64_t* word = bits + i / 64 * PARITY_CHECKS;
+        int shift = i % 64;
+        word[0] |= m0 << shift;
+        word[1] |= m1 << shift;
+        word[2] |= m2 << shift;
+        word[3] |= m3 << shift;
+    }
+#else
+    // Blocks of 64: a flat flag loop the compiler vectorizes, then packing
+    uint8_t flags[64];
+    for (; i + 64 <= n; i += 64) {
+        for (int j = 0; j < 64; j++) {
+            flags[j] = parityFlags(K[i + j], disc, S, F, call_bid[i + j],
+                                   call_ask[i + j], put_bid[i + j],
+                                   put_ask[i + j]);
+        }
+        uint64_t* word = bits + i / 64 * PARITY_CHECKS;
+        for (int c = 0; c < PARITY_CHECKS; c++) {
+            uint64_t packed = 0;
+            for (int j = 0; j < 64; j++) {
+                packed |= uint64_t(flags[j] >> c & 1) << j;
+            }
+            word[c] = packed;
+        }
+    }
+#endif
+    for (; i < n; i++) {
+        uint8_t flags = parityFlags(K[i], disc, S, F, call_bid[i],
+                                    call_ask[i], put_bid[i], put_ask[i]);
+        uint64_t* word = bits + i / 64 * PARITY_CHECKS;
+        for (int c = 0; c < PARITY_CHECKS; c++) {
+            word[c] |= uint64_t(flags >> c & 1) << (i % 64);
+        }
+    }
+}
+
+// Streaming mode //////////////////////////////////////////////////////////
+
+// Power-of-two latency buckets in nanoseconds
+struct LatencyHistogram {
+    static const int BUCKETS = 40;
+    uint64_t counts[BUCKETS] = {};
+    uint64_t samples = 0, max_ns = 0;
+    double sum_ns = 0;
+
+    void record(uint64_t ns) {
+        int bucket = ns ? 64 - __builtin_clzll(ns) : 0; // ns < 2^bucket
+        counts[min(bucket, BUCKETS - 1)]++;
+        samples++;
+        sum_ns += ns;
+        max_ns = max(max_ns, ns);
+    }
+
+    // Upper bound of the bucket holding quantile q
+    uint64_t percentile(double q) const {
+        uint64_t rank = ceil(q * samples), seen = 0;
+        for (int b = 0; b < BUCKETS; b++) {
+            seen += counts[b];
+            if (seen >= rank && seen > 0)
+                return min<uint64_t>(1ull << b, max_ns);
+        }
+        return max_ns;
+    }
+
+    void print(ostream& os) const {
+        if (samples == 0) return;
+        os << "Latency (ns): mean " << sum_ns / samples << ", p50 <= "
+           << percentile(0.5) << ", p99 <= " << percentile(0.99)
+           << ", p99.9 <= " << percentile(0.999) << ", max " << max_ns
+           << endl;
+        for (int b = 0; b < BUCKETS; b++) {
+            if (counts[b] == 0) continue;
+            os << setw(12) << right << (b ? 1ull << (b - 1) : 0) << " - "
+               << setw(12) << left << (1ull << b) << right << setw(10)
+               << counts[b] << endl;
+        }
+    }
+};
+
+// Live quotes of one expiry, one slot per strike, stored as arrays so index
+// and futures ticks can sweep every strike in one loop
+struct ExpiryBook {
+    int expiry_day;
+    double disc = 1;
+    vector<StrikeTicks> strike;
+    vector<double> K; // strike in points, for the parity checks
+    vector<double> call_bid, call_ask, put_bid, put_ask;
+    vector<uint64_t> flags; // raised checks, laid out as in parityKernel()
+    unordered_map<int32_t, uint32_t> slot_of; // keyed by strike ticks
+};
+
+// A parity check that started failing
+struct StreamHit {
+    uint64_t update;
+    uint32_t expiry, slot;
+    uint8_t raised;
+};
+
+class StreamBook {
+   public:
+    vector<ExpiryBook> expiries;
+    double S = NAN, F = NAN; // index and futures mid, NaN until quoted
+    int session_day = -1;
+
+    void setSessionDay(int day) {
+        session_day = day;
+        for (auto& book : expiries) updateDiscount(book);
+    }
+
+    // Find or create the slot for (expiry, strike)
+    void slot(int expiry_day, StrikeTicks strike, uint32_t& e, uint32_t& s) {
+        auto it = expiry_of.find(expiry_day);
+        if (it == expiry_of.end()) {
+            it = expiry_of.emplace(expiry_day, expiries.size()).first;
+            expiries.emplace_back();
+            expiries.back().expiry_day = expiry_day;
+            updateDiscount(expiries.back());
+        }
+        e = it->second;
+
+        ExpiryBook& book = expiries[e];
+        auto [pos, added] = book.slot_of.emplace(strike.count, 0);
+        if (added) {
+            pos->second = book.strike.size();
+            book.strike.push_back(strike);
+            book.K.push_back(strike.value());
+            book.call_bid.push_back(NAN);
+            book.call_ask.push_back(NAN);
+            book.put_bid.push_back(NAN);
+            book.put_ask.push_back(NAN);
+            book.flags.resize(parityWords(book.strike.size()), 0);
+        }
+        s = pos->second;
+    }
+
+    void setQuote(uint32_t e, uint32_t s, char cp_flag, double bid,
+                  double ask) {
+        ExpiryBook& book = expiries[e];
+        if (cp_flag == 'C') {
+            book.call_bid[s] = bid;
+            book.call_ask[s] = ask;
+        } else {
+            book.put_bid[s] = bid;
+            book.put_ask[s] = ask;
+        }
+    }
+
+    // Re-evaluate one strike after an option quote
+    void evaluate(uint32_t e, uint32_t s, uint64_t update,
+                  vector<StreamHit>& hits) {
+        ExpiryBook& book = expiries[e];
+        uint8_t flags = parityFlags(book.K[s], book.disc, S, F,
+                                    book.call_bid[s], book.call_ask[s],
+                                    book.put_bid[s], book.put_ask[s]);
+        uint64_t* word = &book.flags[s / 64 * PARITY_CHECKS];
+        uint8_t raised = 0;
+        for (int c = 0; c < PARITY_CHECKS; c++) {
+            uint64_t bit = 1ull << (s % 64);
+            if ((flags >> c & 1) && !(word[c] & bit)) raised |= 1 << c;
+            word[c] = flags >> c & 1 ? word[c] | bit : word[c] & ~bit;
+        }
+        if (raised) hits.push_back({update, e, s, raised});
+    }
+
+    // Re-evaluate every strike after an index or futures tick
+    void sweep(uint64_t update, vector<StreamHit>& hits) {
+        for (uint32_t e = 0; e < expiries.size(); e++) {
+            ExpiryBook& book = expiries[e];
+            size_t n = book.strike.size();
+            scratch.resize(parityWords(n));
+            parityKernel(n, book.K.data(), book.call_bid.data(),
+                         book.call_ask.data(), book.put_bid.data(),
+                         book.put_ask.data(), book.disc, S, F,
+                         scratch.data());
+
+            for (size_t w = 0; w < scratch.size(); w += PARITY_CHECKS) {
+                uint64_t raised[PARITY_CHECKS], any = 0;
+                for (int c = 0; c < PARITY_CHECKS; c++) {
+                    raised[c] = scratch[w + c] & ~book.flags[w + c];
+                    book.flags[w + c] = scratch[w + c];
+                    any |= raised[c];
+                }
+                for (; any; any &= any - 1) {
+                    int bit = __builtin_ctzll(any);
+                    uint8_t checks = 0;
+                    for (int c = 0; c < PARITY_CHECKS; c++) {
+                        checks |= (raised[c] >> bit & 1) << c;
+                    }
+                    uint32_t slot = w / PARITY_CHECKS * 64 + bit;
+                    hits.push_back({update, e, slot, checks});
+                }
+            }
+        }
+    }
+
+   private:
+    unordered_map<int, uint32_t> expiry_of; // expiry day -> expiries index
+    vector<uint64_t> scratch;               // parityKernel() output
+
+    void updateDiscount(ExpiryBook& book) {
+        double T = max(0, book.expiry_day - session_day) / days_per_year;
+        book.disc = session_day < 0 ? NAN : exp(-r * T);
+    }
+};
+
+// Split a stream record on blanks, returns the number of tokens
+int splitTokens(string_view line, string_view* tokens, int max_tokens) {
+    int count = 0;
+    size_t pos = 0;
+    while (count < max_tokens) {
+        pos = line.find_first_not_of(" \t\r", pos);
+        if (pos == string_view::npos) break;
+        size_t end = line.find_first_of(" \t\r", pos);
+        if (end == string_view::npos) end = line.size();
+        tokens[count++] = line.substr(pos, end - pos);
+        pos = end;
+    }
+    return count;
+}
+
+// Apply one stream record and re-evaluate what it touches
+bool applyStreamUpdate(StreamBook& book, const string_view* tokens, int count,
+                       uint64_t update, vector<StreamHit>& hits) {
+    if (count == 0 || tokens[0].size() != 1) return false;
+    double bid, ask;
+    StrikeTicks strike;
+    switch (tokens[0][0]) {
+        case 'D': { // D <date>
+            int day = count == 2 ? parseDaySerial(tokens[1]) : -1;
+            if (day < 0) return false;
+            book.setSessionDay(day);
+            book.sweep(update, hits);
+            return true;
+        }
+        case 'I':   // I <bid> <ask>
+        case 'F': { // F <bid> <ask>
+            if (count != 3 || !parseNumber(tokens[1], bid) ||
+                !parseNumber(tokens[2], ask))
+                return false;
+            (tokens[0][0] == 'I' ? book.S : book.F) = (bid + ask) / 2.0;
+            book.sweep(update, hits);
+            return true;
+        }
+        case 'O': { // O <exdate> <strike> <C|P> <bid> <ask>
+            uint32_t e, s;
+            int expiry_day = count == 6 ? parseDaySerial(tokens[1]) : -1;
+            if (expiry_day < 0 || tokens[3].size() != 1 ||
+                (tokens[3][0] != 'C' && tokens[3][0] != 'P') ||
+                !parseNumber(tokens[2], strike.count) ||
+                !parseNumber(tokens[4], bid) || !parseNumber(tokens[5], ask))
+                return false;
+            book.slot(expiry_day, strike, e, s);
+            book.setQuote(e, s, tokens[3][0], bid, ask);
+            book.evaluate(e, s, update, hits);
+            return true;
+        }
+    }
+    return false;
+}
+
+// Implied volatility //////////////////////////////////////////////////////
+
+const int IV_HOUSEHOLDER_STEPS = 3; // third-order steps after the guess
+const double IV_MIN_TOTAL_VOL = 1e-4, IV_MAX_TOTAL_VOL = 8.0; // sigma*sqrt(T)
+
+// Normal CDF through the Numerical Recipes erfc fit (relative error below
+// 1.2e-7), free of branches so that loops over it vectorize
+inline double normCdf(double z) {
+    double a = fabs(z) * M_SQRT1_2;
+    double t = 1 / (1 + 0.5 * a);
+    double poly =
+        -1.26551223 +
+        t * (1.00002368 +
+             t * (0.37409196 +
+                  t * (0.09678418 +
+                       t * (-0.18628806 +
+                            t * (0.27886807 +
+                                 t * (-1.13520398 +
+                                      t * (1.48851587 +
+                                           t * (-0.82215223 +
+                                                t * 0.17087277))))))));
+    double tail = 0.5 * t * exp(-a * a + poly);
+    return z < 0 ? tail : 1 - tail;
+}
+
+// Normalized Black call b(x, s) = e^(x/2) N(x/s + s/2) - e^(-x/2) N(x/s - s/2)
+inline double normalizedBlack(double x, double s) {
+    return exp(x / 2) * normCdf(x / s + s / 2) -
+           exp(-x / 2) * normCdf(x / s - s / 2);
+}
+
+// Solve b(x[i], s[i]) = beta[i] for the total volatility s = sigma*sqrt(T).
+// x = ln(F/K) <= 0 (out of the money, where b is well conditioned) and
+// beta is the undiscounted call price over sqrt(F K). As in Jaeckel's
+// method, iterates below the inflection point s = sqrt(2|x|) match
+// ln(b), which is close to linear in 1/s there, and those above match b
+// itself. A closed-form guess is followed by a fixed number of Householder
+// steps, so the loop has no per-lane branch. Out-of-range prices give NaN.
+// The exp/log calls vectorize too when built with -O3 -ffast-math.
+void impliedTotalVols(size_t n, const double* x, const double* beta,
+                      double* s) {
+    for (size_t i = 0; i < n; i++) {
+        double xi = x[i], bi = beta[i];
+        double s_c = sqrt(2 * fabs(xi));
+
+        // Corrado-Miller where its radicand is positive; deep out of the
+        // money it is not, and ln(b) ~ -x^2 / (2 s^2) takes over
+        double sh = sinh(xi / 2), excess = bi - sh;
+        double radicand = excess * excess - 4 * sh * sh / M_PI;
+        double guess = sqrt(2 * M_PI) / (2 * cosh(xi / 2)) *
+                       (excess + sqrt(max(radicand, 0.0)));
+        double tail_guess = min(fabs(xi) / sqrt(-2 * log(bi)), s_c);
+        guess = radicand >= 0 ? guess : tail_guess;
+
+        bool valid = bi > 0 && bi < exp(xi / 2);
+        s[i] = valid ? min(max(guess, IV_MIN_TOTAL_VOL), IV_MAX_TOTAL_VOL)
+                     : NAN;
+    }
+
+    for (int step = 0; step < IV_HOUSEHOLDER_STEPS; step++) {
+        for (size_t i = 0; i < n; i++) {
+            double xi = x[i], si = s[i], bi = beta[i];
+            double b = normalizedBlack(xi, si);
+            bool low = si * si < 2 * fabs(xi); // below the inflection point
+
+            // db/ds and the ratios of the higher derivatives to it
+            double vega = exp(-0.5 * (xi * xi / (si * si) + si * si / 4)) /
+                          sqrt(2 * M_PI);
+            double h2 = xi * xi / (si * si * si) - si / 4;
+            double h3 = h2 * h2 - 3 * xi * xi / (si * si * si * si) - 0.25;
+
+            // The same for ln(b), with r = b'/b
+            double r = vega / b;
+            double nu_log = (log(bi) - log(b)) / r;
+            double h2_log = h2 - r;
+            double h3_log = h3 - 3 * r * h2 + 2 * r * r;
+
+            double nu = low ? nu_log : (bi - b) / vega;
+            h2 = low ? h2_log : h2;
+            h3 = low ? h3_log : h3;
+            double delta =
+                nu * (1 + 0.5 * h2 * nu) / (1 + h2 * nu + h3 * nu * nu / 6);
+            s[i] = min(max(si + delta, IV_MIN_TOTAL_VOL), IV_MAX_TOTAL_VOL);
+        }
+    }
+
+    // Flag invalid inputs again at the end, robust to -ffast-math builds
+    for (size_t i = 0; i < n; i++) {
+        bool valid = beta[i] > 0 && beta[i] < exp(x[i] / 2);
+        s[i] = valid ? s[i] : NAN;
+    }
+}
+
+// Binomial lattice ////////////////////////////////////////////////////////
+// American options without dividends, as elsewhere in the scanner
+
+const int LATTICE_STEPS = 201; // odd, as Leisen-Reimer trees need
+const int LATTICE_LANES = 8;   // options rolled back together
+
+// Peizer-Pratt (method 2) inversion: the probability of an n-step binomial
+// tree, n odd, that matches N(z)
+inline double peizerPratt(double z, int n) {
+    double t = z / (n + 1.0 / 3 + 0.1 / (n + 1));
+    double root = 0.5 * sqrt(1 - exp(-t * t * (n + 1.0 / 6)));
+    return z < 0 ? 0.5 - root : 0.5 + root;
+}
+
+// Early-exercise premiums (American minus European tree value) of
+// LATTICE_LANES options on n-step trees. Each lane is rolled back through
+// O(n) arrays of node prices and values, stored lane-minor so the inner
+// loop vectorizes across options. sign is +1 for calls and -1 for puts.
+// Leisen-Reimer trees are centred on the strike; CRR trees are the
+// u = e^(sigma sqrt(dt)), d = 1/u trees of the lecture notes.
+void latticeLanes(int n, bool leisen_reimer, const double* S, const double* K,
+                  const double* T, const double* vol, const double* sign,
+                  double* premium, vector<double>& spot,
+                  vector<double>& american, vector<double>& european) {
+    const int L = LATTICE_LANES;
+    double up_weight[L], down_weight[L], inv_down[L];
+    spot.resize(size_t(n + 1) * L);
+    american.resize(size_t(n + 1) * L);
+    european.resize(size_t(n + 1) * L);
+    for (int l = 0; l < L; l++) {
+        double dt = T[l] / n, growth = exp(r * dt);
+        double up, down, p;
+        if (leisen_reimer) {
+            double root_T = vol[l] * sqrt(T[l]);
+            double d1 = (log(S[l] / K[l]) + r * T[l]) / root_T + root_T / 2;
+            p = peizerPratt(d1 - root_T, n);
+            up = growth * peizerPratt(d1, n) / p;
+            down = (growth - p * up) / (1 - p);
+        } else {
+            up = exp(vol[l] * sqrt(dt));
+            down = 1 / up;
+            p = (growth - down) / (up - down);
+        }
+        up_weight[l] = p / growth;
+        down_weight[l] = (1 - p) / growth;
+        inv_down[l] = 1 / down;
+
+        // Terminal prices S u^j d^(n-j)
+        double price = S[l] * pow(down, n), ratio = up / down;
+        for (int j = 0; j <= n; j++, price *= ratio) {
+            size_t node = size_t(j) * L + l;
+            spot[node] = price;
+            american[node] = european[node] =
+                max(sign[l] * (price - K[l]), 0.0);
+        }
+    }
+
+    // Step i holds nodes 0..i; S u^j d^(i-j) is the next step's price / d
+    for (int i = n - 1; i >= 0; i--) {
+        for (int j = 0; j <= i; j++) {
+            double* s = &spot[size_t(j) * L];
+            double* a = &american[size_t(j) * L];
+            double* e = &european[size_t(j) * L];
+            for (int l = 0; l < L; l++) {
+                s[l] *= inv_down[l];
+                e[l] = up_weight[l] * e[l + L] + down_weight[l] * e[l];
+                double hold = up_weight[l] * a[l + L] + down_weight[l] * a[l];
+                a[l] = max(hold, sign[l] * (s[l] - K[l]));
+            }
+        }
+    }
+    for (int l = 0; l < L; l++) premium[l] = american[l] - european[l];
+}
+
+// Early-exercise premiums of n options. Premiums on Leisen-Reimer trees
+// converge irregularly, roughly as 1/N, so those of LATTICE_STEPS and about
+// half as many steps are extrapolated (Richardson); for puts this is about
+// as accurate as 1000 to 2000 steps. Calls without dividends get 0.
+// Invalid inputs give NaN.
+void earlyExercisePremiums(size_t n, const double* S, const double* K,
+                           const double* T, const double* vol,
+                           const char* cp_flag, double* out) {
+    const int L = LATTICE_LANES;
+    const int fine = LATTICE_STEPS, coarse = LATTICE_STEPS / 2 | 1;
+    vector<double> spot, american, european;
+    for (size_t begin = 0; begin < n; begin += L) {
+        double lane_S[L], lane_K[L], lane_T[L], lane_vol[L], lane_sign[L];
+        bool valid[L];
+        for (int l = 0; l < L; l++) {
+            size_t i = min(begin + l, n - 1); // pad with the last option
+            lane_sign[l] = cp_flag[i] == 'P' ? -1 : 1;
+            valid[l] = S[i] > 0 && K[i] > 0 && T[i] > 0 && vol[i] > 0;
+            lane_S[l] = valid[l] ? S[i] : 1;
+            lane_K[l] = valid[l] ? K[i] : 1;
+            lane_T[l] = valid[l] ? T[i] : 1;
+            lane_vol[l] = valid[l] ? vol[i] : 0.2;
+        }
+
+        double fine_premium[L], coarse_premium[L];
+        latticeLanes(fine, true, lane_S, lane_K, lane_T, lane_vol, lane_sign,
+                     fine_premium, spot, american, european);
+        latticeLanes(coarse, true, lane_S, lane_K, lane_T, lane_vol,
+                     lane_sign, coarse_premium, spot, american, european);
+
+        for (int l = 0; l < L && begin + l < n; l++) {
+            double premium = (fine * fine_premium[l] -
+                              coarse * coarse_premium[l]) /
+                             (fine - coarse);
+            out[begin + l] = valid[l] ? max(premium, 0.0) : NAN;
+        }
+    }
+}
+
+// Black-Scholes price of a European option, no dividends
+inline double blackScholes(double S, double K, double T, double vol,
+                           char cp_flag) {
+    double sign = cp_flag == 'P' ? -1 : 1, root_T = vol * sqrt(T);
+    double d1 = (log(S / K) + r * T) / root_T + root_T / 2;
+    return sign * (S * normCdf(sign * d1) -
+                   K * exp(-r * T) * normCdf(sign * (d1 - root_T)));
+}
+
+// American prices of n options: Black-Scholes plus the lattice premium
+void americanPrices(size_t n, const double* S, const double* K,
+                    const double* T, const double* vol, const char* cp_flag,
+                    double* out) {
+    earlyExercisePremiums(n, S, K, T, vol, cp_flag, out);
+    for (size_t i = 0; i < n; i++) {
+        double sign = cp_flag[i] == 'P' ? -1 : 1;
+        out[i] = max(blackScholes(S[i], K[i], T[i], vol[i], cp_flag[i]) +
+                         out[i],
+                     sign * (S[i] - K[i]));
+    }
+}
+
+// Monte Carlo /////////////////////////////////////////////////////////////
+// Risk-neutral lognormal paths without dividends. Paths come in numbered
+// blocks of antithetic pairs and every draw is addressed by (stream, block,
+// step, index) in a counter-based generator, so a seed gives the same
+// prices on any number of threads.
+
+const size_t MC_PAIRS_PER_BLOCK = 4096;
+const size_t MC_PATHS = size_t(1) << 20;     // per expiry, by default
+const size_t MC_LSM_PATHS = size_t(1) << 15; // per American option
+const int MC_LSM_STEPS = 50;                 // exercise dates
+
+// Philox4x32-10 (Salmon et al., 2011): ten rounds of a keyed bijection on
+// a 128-bit counter, the counter is replaced by the four outputs
+inline void philox4x32(uint32_t ctr[4], uint64_t seed) {
+    uint32_t k0 = uint32_t(seed), k1 = uint32_t(seed >> 32);
+    for (int round = 0; round < 10; round++) {
+        uint64_t p0 = uint64_t(0xD2511F53) * ctr[0];
+        uint64_t p1 = uint64_t(0xCD9E8D57) * ctr[2];
+        uint32_t x0 = uint32_t(p1 >> 32) ^ ctr[1] ^ k0;
+        uint32_t x2 = uint32_t(p0 >> 32) ^ ctr[3] ^ k1;
+        ctr[0] = x0;
+        ctr[1] = uint32_t(p1);
+        ctr[2] = x2;
+        ctr[3] = uint32_t(p0);
+        k0 += 0x9E3779B9;
+        k1 += 0xBB67AE85;
+    }
+}
+
+// n standard normals (n a multiple of 8) of one (stream, block, step) by
+// Box-Muller. Uniforms fill both halves of z first, so the transform is a
+// plain loop over arrays that vectorizes with -O3 -ffast-math.
+void normalBlock(uint64_t seed, uint32_t stream, uint32_t block,
+                 uint32_t step, size_t n, double* z) {
+    for (size_t i = 0; i < n; i += 4) {
+        uint32_t ctr[4] = {uint32_t(i / 4), step, block, stream};
+        philox4x32(ctr, seed);
+        for (int k = 0; k < 4; k++) z[i + k] = (ctr[k] + 0.5) * 0x1.0p-32;
+    }
+    size_t half = n / 2;
+    for (size_t i = 0; i < half; i++) {
+        double radius = sqrt(-2 * log(z[i]));
+        double angle = 2 * M_PI * z[half + i];
+        z[i] = radius * cos(angle);
+        z[half + i] = radius * sin(angle);
+    }
+}
+
+// Sample sums of a payoff y and a control x with known mean 0
+struct McSums {
+    double n = 0, y = 0, x = 0, yy = 0, xx = 0, xy = 0;
+
+    void merge(const McSums& other) {
+        n += other.n;
+        y += other.y;
+        x += other.x;
+        yy += other.yy;
+        xx += other.xx;
+        xy += other.xy;
+    }
+
+    // Control-variate estimate of E[y] with the regression coefficient,
+    // and its standard error
+    void estimate(double& price, double& std_error) const {
+        double my = y / n, mx = x / n;
+        double var_y = yy / n - my * my, var_x = xx / n - mx * mx;
+        double cov = xy / n - mx * my;
+        double beta = var_x > 0 ? cov / var_x : 0;
+        price = my - beta * mx;
+        std_error = sqrt(max(var_y - beta * cov, 0.0) / max(n - 1, 1.0));
+    }
+};
+
+// Prices and standard errors of n European options of one expiry, all on
+// the same paths. Each antithetic pair is one sample and the discounted
+// terminal price less S is the control variate. Blocks run in parallel
+// and are reduced in block order.
+void monteCarloEuropean(size_t n, double S, double T, const double* K,
+                        const double* vol, const char* cp_flag, size_t paths,
+                        uint64_t seed, uint32_t stream, double* price,
+                        double* std_error) {
+    const size_t B = MC_PAIRS_PER_BLOCK;
+    size_t blocks = max<size_t>(1, (paths / 2 + B - 1) / B);
+    vector<McSums> sums(blocks * n);
+    double disc = exp(-r * T), root_T = sqrt(T);
+
+    atomic<size_t> next_block(0);
+    auto worker = [&]() {
+        vector<double> z(B);
+        for (size_t b; (b = next_block++) < blocks;) {
+            normalBlock(seed, stream, uint32_t(b), 0, B, z.data());
+            for (size_t i = 0; i < n; i++) {
+                double sign = cp_flag[i] == 'P' ? -1 : 1, strike = K[i];
+                double v = vol[i] * root_T;
+                double median = S / disc * exp(-v * v / 2);
+                double y = 0, x = 0, yy = 0, xx = 0, xy = 0;
+                for (size_t p = 0; p < B; p++) {
+                    double g = exp(v * z[p]);
+                    double up = median * g, down = median / g;
+                    double yp = disc * 0.5 *
+                                (max(sign * (up - strike), 0.0) +
+                                 max(sign * (down - strike), 0.0));
+                    double xp = disc * 0.5 * (up + down) - S;
+                    y += yp;
+                    x += xp;
+                    yy += yp * yp;
+                    xx += xp * xp;
+                    xy += xp * yp;
+                }
+                sums[b * n + i] = {double(B), y, x, yy, xx, xy};
+            }
+        }
+    };
+    size_t workers = max<size_t>(
+        1, min<size_t>(thread::hardware_concurrency(), blocks));
+    vector<thread> pool;
+    for (size_t w = 1; w < workers; w++) pool.emplace_back(worker);
+    worker();
+    for (auto& t : pool) t.join();
+
+    for (size_t i = 0; i < n; i++) {
+        McSums total;
+        for (size_t b = 0; b < blocks; b++) total.merge(sums[b * n + i]);
+        total.estimate(price[i], std_error[i]);
+    }
+}
+
+// Longstaff-Schwartz price of one American option on MC_LSM_STEPS
+// exercise dates. Continuation values are regressed on 1, x, x^2 with
+// x = S/K over the in-the-money paths, and the European payoff on the
+// same paths, less its Black-Scholes price, is the control variate. The
+// in-sample exercise rule biases the price slightly low. scratch holds
+// the paths between calls; the caller runs options in parallel.
+void longstaffSchwartz(double S, double K, double T, double vol,
+                       char cp_flag, size_t paths, uint64_t seed,
+                       uint32_t stream, double& price, double& std_error,
+                       vector<double>& scratch) {
+    const size_t B = MC_PAIRS_PER_BLOCK;
+    const int M = MC_LSM_STEPS;
+    size_t blocks = max<size_t>(1, (paths / 2 + B - 1) / B);
+    size_t P = blocks * B, row = 2 * P; // pairs, paths per step
+    double sign = cp_flag == 'P' ? -1 : 1, dt = T / M;
+    double v = vol * sqrt(dt), step_disc = exp(-r * dt);
+    double drift = exp(r * dt - v * v / 2);
+
+    // spot[(t - 1) * row + p]: up paths below P, their mirrors above
+    scratch.resize(size_t(M) * row + row + B);
+    double* spot = scratch.data();
+    double* cash = spot + size_t(M) * row; // value at the current date
+    double* z = cash + row;
+    for (size_t b = 0; b < blocks; b++) {
+        for (int t = 1; t <= M; t++) {
+            normalBlock(seed, stream, uint32_t(b), t, B, z);
+            double* up = spot + size_t(t - 1) * row + b * B;
+            double* down = up + P;
+            for (size_t p = 0; p < B; p++) {
+                double g = exp(v * z[p]);
+                double up_prev = t > 1 ? up[p - row] : S;
+                double down_prev = t > 1 ? down[p - row] : S;
+                up[p] = up_prev * drift * g;
+                down[p] = down_prev * drift / g;
+            }
+        }
+    }
+
+    const double* last = spot + size_t(M - 1) * row;
+    for (size_t p = 0; p < row; p++)
+        cash[p] = max(sign * (last[p] - K), 0.0);
+
+    for (int t = M - 1; t >= 1; t--) {
+        const double* s = spot + size_t(t - 1) * row;
+        // Normal equations of the regression over in-the-money paths
+        double m[5] = {0, 0, 0, 0, 0}, c[3] = {0, 0, 0};
+        for (size_t p = 0; p < row; p++) {
+            cash[p] *= step_disc;
+            if (sign * (s[p] - K) <= 0) continue;
+            double x = s[p] / K, x2 = x * x;
+            m[0] += 1;
+            m[1] += x;
+            m[2] += x2;
+            m[3] += x2 * x;
+            m[4] += x2 * x2;
+            c[0] += cash[p];
+            c[1] += cash[p] * x;
+            c[2] += cash[p] * x2;
+        }
+        if (m[0] < 3) continue;
+
+        // Cramer's rule on the symmetric 3x3 system
+        double a = m[0], b = m[1], d = m[2], e = m[3], f = m[4];
+        double det = a * (d * f - e * e) - b * (b * f - d * e) +
+                     d * (b * e - d * d);
+        if (fabs(det) < 1e-12 * a * a * a) continue;
+        double beta0 = (c[0] * (d * f - e * e) - b * (c[1] * f - e * c[2]) +
+                        d * (c[1] * e - d * c[2])) /
+                       det;
+        double beta1 = (a * (c[1] * f - e * c[2]) -
+                        c[0] * (b * f - d * e) + d * (b * c[2] - c[1] * d)) /
+                       det;
+        double beta2 = (a * (d * c[2] - c[1] * e) -
+                        b * (b * c[2] - c[1] * d) + c[0] * (b * e - d * d)) /
+                       det;
+
+        for (size_t p = 0; p < row; p++) {
+            double exercise = sign * (s[p] - K);
+            if (exercise <= 0) continue;
+            double x = s[p] / K;
+            if (exercise > beta0 + x * (beta1 + x * beta2))
+                cash[p] = exercise;
+        }
+    }
+
+    double disc = exp(-r * T);
+    double european = blackScholes(S, K, T, vol, cp_flag);
+    McSums sums;
+    for (size_t p = 0; p < P; p++) {
+        double y = step_disc * 0.5 * (cash[p] + cash[p + P]);
+        double x = disc * 0.5 *
+                       (max(sign * (last[p] - K), 0.0) +
+                        max(sign * (last[p + P] - K), 0.0)) -
+                   european;
+        sums.merge({1, y, x, y * y, x * x, x * y});
+    }
+    sums.estimate(price, std_error);
+    price = max(price, sign * (S - K));
+}
+
+// Greeks //////////////////////////////////////////////////////////////////
+
+// Black-Scholes values and sensitivities of a batch of options, one array
+// per quantity: per index point, per 1.00 of vol or rate, and per year
+struct ChainGreeks {
+    vector<double> price, delta, gamma, vega, vanna, volga, rho, theta;
+};
+
+const int GREEK_COUNT = 8;
+vector<double> ChainGreeks::*const greek_fields[GREEK_COUNT] = {
+    &ChainGreeks::price, &ChainGreeks::delta, &ChainGreeks::gamma,
+    &ChainGreeks::vega,  &ChainGreeks::vanna, &ChainGreeks::volga,
+    &ChainGreeks::rho,   &ChainGreeks::theta};
+
+// Price and Greeks of n options in one forward sweep and one adjoint
+// sweep. The forward sweep keeps its intermediates in registers and the
+// adjoint sweep propagates price_bar = 1 back through them, giving the
+// derivatives to S, vol, r and T at about twice the cost of a price,
+// where bumping would reprice once per input. Second-order terms are
+// formed from the same intermediates. The loop has no per-option branch.
+void blackScholesGreeks(size_t n, const double* S, const double* K,
+                        const double* T, const double* vol,
+                        const char* cp_flag, ChainGreeks& out) {
+    for (int f = 0; f < GREEK_COUNT; f++) (out.*greek_fields[f]).resize(n);
+    const double inv_sqrt_2pi = 1 / sqrt(2 * M_PI);
+    for (size_t i = 0; i < n; i++) {
+        // Forward sweep
+        double sign = cp_flag[i] == 'P' ? -1 : 1;
+        double root_T = sqrt(T[i]), v = vol[i] * root_T;
+        double drift = log(S[i] / K[i]) + r * T[i];
+        double d1 = drift / v + v / 2, d2 = d1 - v;
+        double disc = exp(-r * T[i]);
+        double n1 = normCdf(sign * d1), n2 = normCdf(sign * d2);
+        double price = sign * (S[i] * n1 - K[i] * disc * n2);
+
+        // Adjoint sweep, statements in reverse
+        double pdf1 = inv_sqrt_2pi * exp(-d1 * d1 / 2);
+        double pdf2 = inv_sqrt_2pi * exp(-d2 * d2 / 2);
+        double n1_bar = sign * S[i], n2_bar = -sign * K[i] * disc;
+        double disc_bar = -sign * K[i] * n2;
+        double d2_bar = n2_bar * sign * pdf2;
+        double d1_bar = n1_bar * sign * pdf1 + d2_bar;
+        double v_bar = d1_bar * (0.5 - drift / (v * v)) - d2_bar;
+        double S_bar = sign * n1 + d1_bar / (S[i] * v);
+        double r_bar = d1_bar * T[i] / v - disc_bar * T[i] * disc;
+        double T_bar = d1_bar * r / v - disc_bar * r * disc +
+                       v_bar * vol[i] / (2 * root_T);
+        double vol_bar = v_bar * root_T;
+
+        out.price[i] = price;
+        out.delta[i] = S_bar;
+        out.vega[i] = vol_bar;
+        out.rho[i] = r_bar;
+        out.theta[i] = -T_bar;
+        out.gamma[i] = pdf1 / (S[i] * v);
+        out.vanna[i] = -pdf1 * d2 / vol[i];
+        out.volga[i] = vol_bar * d1 * d2 / vol[i];
+    }
+}
+
+// Dollar Greeks of a position: per index point (gamma per point squared),
+// per vol point, per 1% of rate and per calendar day
+struct PositionGreeks {
+    double delta = 0, gamma = 0, vega = 0, rho = 0, theta = 0;
+};
+
+// Synthetic chains ////////////////////////////////////////////////////////
+
+// Shape of a generated chain: dates * expiries * strikes call/put rows
+struct ChainSpec {
+    int dates = 1;                // consecutive quote days from 2020-11-03
+    int expiries = 10;            // weekly expiries after each quote day
+    int strikes = 100;            // per expiry, spread over 0.5 S to 1.5 S
+    double spread_noise = 1.0;    // scale of the random half spread
+    double violation_rate = 0.01; // share of strikes with a shifted call
+    uint64_t seed = 1;
+};
+
+const double SYNTH_SPOT = 3369.16;                 // index close on 11-03
+const double SYNTH_VOL = 0.2, SYNTH_SKEW = -0.3;   // sigma = vol + skew x
+const double SYNTH_TICK = 0.05;                    // quote increment
+const double SYNTH_MIN_SHIFT = 10, SYNTH_MAX_SHIFT = 30; // violation points
+const int SYNTH_FIRST_DAY = 18569;                 // 2020-11-03
+
+// Write days since 1970-01-01 as a terminated "YYYY-MM-DD" (years 0-9999)
+void formatDaySerial(int days, char* out) {
+    days += 719468;
+    int era = (days >= 0 ? days : days - 146096) / 146097;
+    int doe = days - era * 146097;
+    int yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+    int doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+    int mp = (5 * doy + 2) / 153;
+    int d = doy - (153 * mp + 2) / 5 + 1;
+    int m = mp < 10 ? mp + 3 : mp - 9;
+    int y = yoe + era * 400 + (m <= 2);
+    const int value[3] = {y, m, d}, width[3] = {4, 2, 2};
+    for (int f = 0, pos = 0; f < 3; f++) {
+        for (int i = width[f] - 1, v = value[f]; i >= 0; i--, v /= 10) {
+            out[pos + i] = char('0' + v % 10);
+        }
+        pos += width[f];
+        out[pos++] = f < 2 ? '-' : '\0';
+    }
+}
+
+// Write a chain in the loadOptionsData() layout. Mid prices follow
+// Black-Scholes with a linear skew, so clean strikes satisfy parity; each
+// strike's call is shifted by SYNTH_MIN_SHIFT to SYNTH_MAX_SHIFT points
+// with probability violation_rate. Returns the number of rows written.
+size_t generateChain(const string& filename, const ChainSpec& spec) {
+    ofstream file(filename, ios::binary);
+    if (!file.is_open()) {
+        cout << "Error: Cannot create " << filename << endl;
+        return 0;
+    }
+    file << "optionid\tdate\tcp_flag\texercise_style\tsecid\texdate\t"
+            "last_date\tvolume\tbest_bid\tbest_offer\tstrike_price\n";
+
+    SplitMix64 rng{spec.seed};
+    string buffer;
+    char line[160], date[11], exdate[11];
+    size_t rows = 0;
+    for (int d = 0; d < spec.dates; d++) {
+        int day = SYNTH_FIRST_DAY + d;
+        formatDaySerial(day, date);
+        for (int e = 0; e < spec.expiries; e++) {
+            formatDaySerial(day + 7 * (e + 1), exdate);
+            double T = 7 * (e + 1) / days_per_year;
+            double disc = exp(-r * T), F = SYNTH_SPOT / disc;
+            for (int k = 0; k < spec.strikes; k++) {
+                StrikeTicks strike = {int32_t(
+                    llround(SYNTH_SPOT * (0.5 + (k + 0.5) / spec.strikes) *
+                            1000))};
+                double K = strike.value(), x = log(K / F);
+                double vol = max(SYNTH_VOL + SYNTH_SKEW * x, 0.05);
+                double d1 = (-x + 0.5 * vol * vol * T) / (vol * sqrt(T));
+                double d2 = d1 - vol * sqrt(T);
+                double call = disc * (F * normCdf(d1) - K * normCdf(d2));
+                double put = call - disc * (F - K);
+                if (rng.uniform() < spec.violation_rate) {
+                    double shift =
+                        SYNTH_MIN_SHIFT +
+                        (SYNTH_MAX_SHIFT - SYNTH_MIN_SHIFT) * rng.uniform();
+                    call += rng.uniform() < 0.5 ? -shift : shift;
+                }
+
+                for (int leg = 0; leg < 2; leg++) {
+                    double mid = max(leg == 0 ? call : put, 0.0);
+                    double half = SYNTH_TICK + spec.spread_noise *
+                                                   rng.uniform() *
+                                                   (0.1 + 0.01 * mid);
+                    double bid =
+                        max(floor((mid - half) / SYNTH_TICK), 0.0) * SYNTH_TICK;
+                    double ask = ceil((mid + half) / SYNTH_TICK) * SYNTH_TICK;
+                    int volume = int(rng.next() % 1000);
+                    int n = snprintf(line, sizeof(line),
+                                     "%zu\t%s\t%c\tE\t108105\t%s\t%s\t%d\t"
+                                     "%.2f\t%.2f\t%d\n",
+                                     100001 + rows, date, leg ? 'P' : 'C',
+                                     exdate, date, volume, bid, ask,
+                                     int(strike.count));
+                    buffer.append(line, n);
+                    rows++;
+                }
+            }
+            file.write(buffer.data(), buffer.size());
+            buffer.clear();
+        }
+    }
+    return file ? rows : 0;
+}
+
+// Request server ///////////////////////////////////////////////////////////
+// Scan requests over the framing of request_server.h
+
+// Ops 1-4 are the bond requests served by hw2
+const uint16_t OP_PARITY_SCAN = 5;
+
+// OP_PARITY_SCAN item; zero fields match every underlying or day
+struct ScanQuery {
+    uint32_t secid;
+    DaySerial day, expiry_day;
+    uint32_t max_hits; // 0 for max_displayed_opportunities
+};
+
+// OP_PARITY_SCAN result, best hit per strike by underlying and strike
+struct ScanHit {
+    uint32_t secid;
+    DaySerial day, expiry_day;
+    int32_t strike;   // StrikeTicks count
+    uint8_t strategy; // Strategy
+    uint8_t reserved[3];
+    double profit;
+};
+static_assert(sizeof(ScanHit) == 24, "ScanHit is sent as is");
+
 class ArbitrageScanner {
    private:
-    MarketData market;
-    vector<OptionData> options;
-    vector<ArbitrageOpportunity> opportunities;
+    MarketHistory history; // for underlyings without an entry of their own
+    unordered_map<uint32_t, MarketHistory> underlyings; // by secid
+    vector<MarketData> snapshots; // one per (secid, date), see groups
+    OptionChain options;
+    vector<uint32_t> pair_order; // scratch for pairCallsAndPuts()
+    vector<OptionPair> pairs;
+    vector<ExpiryGroup> groups;
+    OpportunityBook opportunities;
+    vector<double> iv_bid, iv_mid, iv_ask; // per option row, see solveIVs()
+    ChainGreeks greeks; // per option row, see computeGreeks()
+    OutputPolicy output_policy = OUTPUT_BLOCK; // of the scan's strike lines
 
     double calculateTransactionCost(int num_index, int num_futures,
                                     int num_options) {
@@ -65,78 +1911,73 @@ class ArbitrageScanner {
                num_options * option_transaction_cost;
     }
 
-    void scanPutCallParity(const OptionData& call, const OptionData& put) {
-        if (call.strike != put.strike) return;
+    void scanPutCallParity(uint32_t g, uint32_t call, uint32_t put,
+                           OpportunityBook& out) {
+        if (options.strike[call] != options.strike[put]) return;
 
-        double K =
-            call.strike / 100000.0; // Strike is in format like 100000 = 1000.00
+        const MarketData& market = *groups[g].market;
+        double K = strikeOf(call);
         double S = (market.index_bid + market.index_ask) / 2.0; // Mid price
-        double disc = exp(-r * T);
+        double disc = groups[g].disc;
 
         // Theoretical Put-Call Parity: C - P = S - K*e^(-rT)
         double theoretical_diff = S - K * disc;
 
         // Actual market differences
         double actual_diff_high =
-            call.best_offer - put.best_bid; // C_ask - P_bid
+            askOf(call) - bidOf(put); // C_ask - P_bid
         double actual_diff_low =
-            call.best_bid - put.best_offer; // C_bid - P_ask
+            bidOf(call) - askOf(put); // C_bid - P_ask
 
         // Strategy 1: Long Call + Short Put (when C - P is too cheap)
         double cost1 =
-            calculateTransactionCost(1, 0, 2); // Long index, 2 options
+            calculateTransactionCost(1, 0, 2); // Short index, 2 options
         double cost1_per_point = cost1 / option_point_value;
 
         if (theoretical_diff - actual_diff_low > cost1_per_point) {
             double profit =
                 (theoretical_diff - actual_diff_low) * option_point_value -
                 cost1;
-            ArbitrageOpportunity opp;
-            opp.strategy =
-                "Put-Call Parity: Long Call + Short Put + Long Index";
-            opp.profit = profit;
-            opp.strike = K;
-            opp.details = "Long Call@" + to_string(call.best_offer) +
-                          ", Short Put@" + to_string(put.best_bid) +
-                          ", Long Index@" + to_string(market.index_ask);
-            opportunities.push_back(opp);
+            ArbitrageOpportunity opp = {
+                PARITY_LONG_CALL_STRATEGY, g, {call, put}, profit,
+                options.strike[call], groups[g].secid};
+            out.add(opp);
         }
 
         // Strategy 2: Short Call + Long Put (when C - P is too expensive)
         double cost2 =
-            calculateTransactionCost(1, 0, 2); // Short index, 2 options
+            calculateTransactionCost(1, 0, 2); // Long index, 2 options
         double cost2_per_point = cost2 / option_point_value;
 
         if (actual_diff_high - theoretical_diff > cost2_per_point) {
             double profit =
                 (actual_diff_high - theoretical_diff) * option_point_value -
                 cost2;
-            ArbitrageOpportunity opp;
-            opp.strategy =
-                "Put-Call Parity: Short Call + Long Put + Short Index";
-            opp.profit = profit;
-            opp.strike = K;
-            opp.details = "Short Call@" + to_string(call.best_bid) +
-                          ", Long Put@" + to_string(put.best_offer) +
-                          ", Short Index@" + to_string(market.index_bid);
-            opportunities.push_back(opp);
+            ArbitrageOpportunity opp = {
+                PARITY_SHORT_CALL_STRATEGY, g, {call, put}, profit,
+                options.strike[call], groups[g].secid};
+            out.add(opp);
         }
     }
 
-    void scanPutCallFuturesParity(const OptionData& call,
-                                  const OptionData& put) {
-        if (call.strike != put.strike || !market.has_future) return;
+    void scanPutCallFuturesParity(uint32_t g, uint32_t call, uint32_t put,
+                                  OpportunityBook& out) {
+        const MarketData& market = *groups[g].market;
+        if (options.strike[call] != options.strike[put] || !market.has_future)
+            return;
 
-        double K = call.strike / 100000.0;
+        double K = strikeOf(call);
         double F = (market.future_bid + market.future_ask) / 2.0; // Mid price
-        double disc = exp(-r * T);
+        double disc = groups[g].disc;
 
         // Theoretical Put-Call-Futures Parity: C - P = F*e^(-rT) - K*e^(-rT)
         double theoretical_diff = F * disc - K * disc;
 
         // Actual market differences
-        double actual_diff_high = call.best_offer - put.best_bid;
-        double actual_diff_low = call.best_bid - put.best_offer;
+        double actual_diff_high =
+            askOf(call) - bidOf(put);
+        double actual_diff_low =
+            bidOf(call) - askOf(put);
 
         // Strategy 1: Long Call + Short Put + Short Future
         double cost1 = calculateTransactionCost(0, 1, 2); // 1 future, 2 options
@@ -146,15 +1987,10 @@ class ArbitrageScanner {
             double profit =
                 (actual_diff_high - theoretical_diff) * option_point_value -
                 cost1;
-            ArbitrageOpportunity opp;
-            opp.strategy =
-                "Put-Call-Futures Parity: Long Call + Short Put + Short Future";
-            opp.profit = profit;
-            opp.strike = K;
-            opp.details = "Long Call@" + to_string(call.best_offer) +
-                          ", Short Put@" + to_string(put.best_bid) +
-                          ", Short Future@" + to_string(market.future_bid);
-            opportunities.push_back(opp);
+            ArbitrageOpportunity opp = {
+                FUTURES_PARITY_LONG_CALL_STRATEGY, g, {call, put}, profit,
+                options.strike[call], groups[g].secid};
+            out.add(opp);
         }
 
         // Strategy 2: Short Call + Long Put + Long Future
@@ -162,195 +1998,935 @@ class ArbitrageScanner {
             double profit =
                 (theoretical_diff - actual_diff_low) * option_point_value -
                 cost1;
-            ArbitrageOpportunity opp;
-            opp.strategy =
-                "Put-Call-Futures Parity: Short Call + Long Put + Long Future";
-            opp.profit = profit;
-            opp.strike = K;
-            opp.details = "Short Call@" + to_string(call.best_bid) +
-                          ", Long Put@" + to_string(put.best_offer) +
-                          ", Long Future@" + to_string(market.future_ask);
-            opportunities.push_back(opp);
+            ArbitrageOpportunity opp = {
+                FUTURES_PARITY_SHORT_CALL_STRATEGY, g, {call, put}, profit,
+                options.strike[call], groups[g].secid};
+            out.add(opp);
         }
     }
 
+    // Without dividends an American pair satisfies S - K <= C - P <=
+    // S - K e^(-rT), and neither option trades below its exercise value.
+    // Early assignment of a short leg only ends a trade early, with at
+    // least the same profit.
+    void scanAmericanBounds(uint32_t g, uint32_t call, uint32_t put,
+                            OpportunityBook& out) {
+        const MarketData& market = *groups[g].market;
+        if (options.strike[call] != options.strike[put] || !market.has_index)
+            return;
+
+        double K = strikeOf(call);
+        double disc = groups[g].disc;
+        double parity_cost = calculateTransactionCost(1, 0, 2);
+        double exercise_cost = calculateTransactionCost(1, 0, 1);
+        auto add = [&](Strategy strategy, uint32_t leg0, uint32_t leg1,
+                       double edge, double cost) {
+            double profit = edge * option_point_value - cost;
+            if (profit <= 0) return;
+            ArbitrageOpportunity opp = {
+                strategy, g, {leg0, leg1}, profit, options.strike[call],
+                groups[g].secid};
+            out.add(opp);
+        };
+
+        // C - P below S - K: buy the call, sell the put and the index
+        add(AMERICAN_PARITY_LONG_CALL_STRATEGY, call, put,
+            market.index_bid - K -
+                (askOf(call) - bidOf(put)),
+            parity_cost);
+        // C - P above S - K e^(-rT): the reverse
+        add(AMERICAN_PARITY_SHORT_CALL_STRATEGY, call, put,
+            bidOf(call) - askOf(put) -
+                (market.index_ask - K * disc),
+            parity_cost);
+        // Buy below exercise value and exercise at once
+        add(CALL_EXERCISE_STRATEGY, call, call,
+            market.index_bid - K - askOf(call), exercise_cost);
+        add(PUT_EXERCISE_STRATEGY, put, put,
+            K - market.index_ask - askOf(put), exercise_cost);
+    }
+
    public:
+    void setMarketHistory(const MarketHistory& data) { history = data; }
+    void setOutputPolicy(OutputPolicy policy) { output_policy = policy; }
+    size_t optionCount() const { return options.size(); }
+    size_t hitCount() const { return opportunities.hits; }
+
     bool loadIndexData(const string& filename) {
-        ifstream file(filename);
-        if (!file.is_open()) {
-            cout << "Error: Cannot open " << filename << endl;
-            return false;
-        }
+        return loadIndexData(filename, history);
+    }
 
-        string line;
-        getline(file, line); // Skip header
-
-        // Read the most recent data (assuming data is sorted by date)
-        if (getline(file, line)) {
-            stringstream ss(line);
-            string date, price_str, open_str, high_str, low_str, vol_str,
-                change_str;
-
-            getline(ss, date, ',');
-            getline(ss, price_str, ',');
-            getline(ss, open_str, ',');
-            getline(ss, high_str, ',');
-            getline(ss, low_str, ',');
-
-            try {
-                double price = stod(price_str);
-                // Assuming bid-ask spread of 0.1% around mid price
-                market.index_bid = price * 0.999;
-                market.index_ask = price * 1.001;
-                market.has_index = true;
-                cout << "Loaded S&P 500 Index: " << price
-                     << " (Bid: " << market.index_bid
-                     << ", Ask: " << market.index_ask << ")" << endl;
-            } catch (const exception& e) {
-                cout << "Error parsing index price: " << e.what() << endl;
-                return false;
+    bool loadFuturesData(const string& filename) {
+        return loadFuturesData(filename, history);
+    }
+
+    // Index and futures files per underlying, one "secid,index,futures"
+    // line each (either file may be left empty). Underlyings not listed
+    // use the default files. Returns false when there is no such list.
+    bool loadUnderlyings(const string& filename) {
+        ifstream file(filename);
+        if (!file.is_open()) return false;
+
+        string text((istreambuf_iterator<char>(file)),
+                    istreambuf_iterator<char>());
+        CsvReader reader(text.data(), text.size());
+        vector<string_view> fields;
+        while (reader.next(fields)) {
+            if (fields[0].empty() || !isdigit((unsigned char)fields[0][0]))
+                continue; // Skip the header and comments
+
+            string index_file, futures_file;
+            if (fields.size() > 1) index_file = unescapeCsvField(fields[1]);
+            if (fields.size() > 2) futures_file = unescapeCsvField(fields[2]);
+
+            uint32_t secid;
+            if (!parseNumber(fields[0], secid)) {
+                cout << "Error: Invalid secid " << fields[0] << endl;
+                continue;
             }
+            cout << "Underlying " << secid << ":" << endl;
+            MarketHistory& prices = underlyings[secid];
+            if (!index_file.empty()) loadIndexData(index_file, prices);
+            if (!futures_file.empty()) loadFuturesData(futures_file, prices);
         }
+        return !underlyings.empty();
+    }
 
-        file.close();
-        return market.has_index;
+    // Price histories used for an underlying's parity checks
+    const MarketHistory& historyOf(uint32_t secid) const {
+        auto it = underlyings.find(secid);
+        return it != underlyings.end() ? it->second : history;
     }
 
-    bool loadFuturesData(const string& filename) {
-        ifstream file(filename);
-        if (!file.is_open()) {
+    // Every "Date,Price,..." row of a price file, sorted by day
+    // Quoted or bare fields, thousands separators allowed (see csv.h)
+    bool loadPriceHistory(const string& filename, PriceHistory& prices) {
+        MappedFile file;
+        if (!file.map(filename)) {
             cout << "Error: Cannot open " << filename << endl;
             return false;
         }
 
-        string line;
-        getline(file, line); // Skip header
-
-        if (getline(file, line)) {
-            stringstream ss(line);
-            string date, price_str, open_str, high_str, low_str, vol_str,
-                change_str;
-
-            getline(ss, date, ',');
-            getline(ss, price_str, ',');
-            getline(ss, open_str, ',');
-            getline(ss, high_str, ',');
-            getline(ss, low_str, ',');
-
-            try {
-                double price = stod(price_str);
-                // Assuming bid-ask spread of 0.05% around mid price
-                market.future_bid = price * 0.9995;
-                market.future_ask = price * 1.0005;
-                market.has_future = true;
-                cout << "Loaded S&P 500 Futures: " << price
-                     << " (Bid: " << market.future_bid
-                     << ", Ask: " << market.future_ask << ")" << endl;
-            } catch (const exception& e) {
-                cout << "Error parsing futures price: " << e.what() << endl;
-                return false;
+        CsvReader reader(file.data, file.size);
+        vector<string_view> fields;
+        reader.next(fields); // Skip header
+
+        prices = PriceHistory();
+        size_t rejected = 0;
+        while (reader.next(fields)) {
+            int day = fields.size() >= 2 ? parseUsDaySerial(fields[0]) : -1;
+            double price;
+            if (day < 0 || !parseCsvNumber(fields[1], price)) {
+                if (rejected++ == 0) {
+                    cout << "Error parsing " << filename << " line "
+                         << reader.line() << endl;
+                }
+                continue;
             }
+            prices.day.push_back(day);
+            prices.close.push_back(price);
         }
+        if (rejected > 1) {
+            cout << "Rejected " << rejected << " rows of " << filename
+                 << endl;
+        }
+
+        prices.sortByDay();
+        return !prices.empty();
+    }
+
+    // "  n daily closes from ... to ...", for files with a history
+    void printHistoryRange(const PriceHistory& prices) const {
+        if (prices.day.size() < 2) return;
+        char first[11], last[11];
+        formatDaySerial(prices.day.front(), first);
+        formatDaySerial(prices.day.back(), last);
+        cout << "  " << prices.day.size() << " daily closes from " << first
+             << " to " << last << endl;
+    }
+
+    bool loadIndexData(const string& filename, MarketHistory& prices) {
+        PROFILE_STAGE(STAGE_LOAD_MARKET);
+        if (!loadPriceHistory(filename, prices.index)) return false;
+
+        // The most recent close, as the scan of a single day uses
+        MarketData latest = prices.quotesAt(prices.index.day.back());
+        cout << "Loaded S&P 500 Index: " << prices.index.close.back()
+             << " (Bid: " << latest.index_bid
+             << ", Ask: " << latest.index_ask << ")" << endl;
+        printHistoryRange(prices.index);
+        return true;
+    }
+
+    bool loadFuturesData(const string& filename, MarketHistory& prices) {
+        PROFILE_STAGE(STAGE_LOAD_MARKET);
+        if (!loadPriceHistory(filename, prices.futures)) return false;
 
-        file.close();
-        return market.has_future;
+        MarketData latest = prices.quotesAt(prices.futures.day.back());
+        cout << "Loaded S&P 500 Futures: " << prices.futures.close.back()
+             << " (Bid: " << latest.future_bid
+             << ", Ask: " << latest.future_ask << ")" << endl;
+        printHistoryRange(prices.futures);
+        return true;
     }
 
     bool loadOptionsData(const string& filename) {
-        ifstream file(filename);
-        if (!file.is_open()) {
+        PROFILE_STAGE(STAGE_LOAD_OPTIONS);
+        // Mapped only while parsing, nothing keeps pointers into it
+        MappedFile file;
+        if (!file.map(filename)) {
             cout << "Error: Cannot open " << filename << endl;
             return false;
         }
 
-        string line;
-        while (getline(file, line)) {
-            if (line.empty() || line[0] == '#')
-                continue; // Skip comments and empty lines
-
-            stringstream ss(line);
-            string token;
-            vector<string> fields;
-
-            while (getline(ss, token, '\t')) { // Assuming tab-separated
-                fields.push_back(token);
-            }
-
-            if (fields.size() >= 11) { // Ensure we have enough fields
-                try {
-                    OptionData opt;
-                    opt.option_id = fields[0];
-                    opt.date = fields[1];
-                    opt.cp_flag = fields[2][0];
-                    opt.exercise_style = fields[3][0];
-                    opt.exdate = fields[5];
-                    opt.strike = stod(
-                        fields[10]); // Strike is already multiplied by 1000
-                    opt.best_bid = stod(fields[8]);
-                    opt.best_offer = stod(fields[9]);
-                    opt.volume = stoi(fields[7]);
-
-                    // Only include European options with valid bid/ask
-                    if (opt.exercise_style == 'E' && opt.best_bid > 0 &&
-                        opt.best_offer > 0) {
-                        options.push_back(opt);
-                    }
-                } catch (const exception& e) {
-                    // Skip invalid lines
-                    continue;
-                }
+        // Cut the file into line-aligned chunks, one parser thread each
+        const char* data = file.data;
+        size_t size = file.size;
+        size_t workers = max<size_t>(
+            1, min<size_t>(thread::hardware_concurrency(),
+                           size / MIN_PARSE_CHUNK));
+        vector<const char*> bounds = {data};
+        for (size_t w = 1; w < workers; w++) {
+            const char* cut = max(bounds.back(), data + size * w / workers);
+            const char* eol =
+                static_cast<const char*>(memchr(cut, '\n', data + size - cut));
+            bounds.push_back(eol ? eol + 1 : data + size);
+        }
+        bounds.push_back(data + size);
+
+        vector<OptionsChunk> chunks(workers);
+        vector<thread> parsers;
+        for (size_t w = 1; w < workers; w++) {
+            parsers.emplace_back(parseOptionsChunk, bounds[w], bounds[w + 1],
+                                 false, ref(chunks[w]));
+        }
+        parseOptionsChunk(bounds[0], bounds[1], true, chunks[0]);
+        for (auto& t : parsers) t.join();
+
+        // Merge in file order, turning local line numbers into global ones
+        size_t total = 0, line_base = 0;
+        for (const auto& chunk : chunks) total += chunk.options.size();
+        options = OptionChain();
+        options.reserve(total);
+        vector<ParseError> errors;
+        for (auto& chunk : chunks) {
+            options.append(chunk.options);
+            for (auto err : chunk.errors) {
+                err.line += line_base;
+                errors.push_back(err);
             }
+            line_base += chunk.lines;
         }
 
-        file.close();
-        cout << "Loaded " << options.size() << " valid European options"
-             << endl;
+        PROFILE_COUNT(ROWS_PARSED, options.size());
+        PROFILE_COUNT(ROWS_REJECTED, errors.size());
+        size_t american = count(options.exercise_style.begin(),
+                                options.exercise_style.end(), 'A');
+        if (american == 0) {
+            cout << "Loaded " << options.size() << " valid European options"
+                 << endl;
+        } else {
+            cout << "Loaded " << options.size() - american
+                 << " valid European and " << american
+                 << " valid American options" << endl;
+        }
+        if (!errors.empty()) {
+            cout << "Rejected " << errors.size() << " malformed rows" << endl;
+            int shown = min<int>(errors.size(), MAX_REPORTED_PARSE_ERRORS);
+            for (int i = 0; i < shown; i++) {
+                cout << "  line " << errors[i].line << ": "
+                     << errors[i].reason << endl;
+            }
+        }
         return !options.empty();
     }
 
-    void scanArbitrageOpportunities() {
-        // Group options by strike price
-        map<double, vector<OptionData>> options_by_strike;
+    // Strike and quotes of an option row in index points
+    double strikeOf(uint32_t row) const { return options.strike[row].value(); }
+    double bidOf(uint32_t row) const { return options.best_bid[row].value(); }
+    double askOf(uint32_t row) const {
+        return options.best_offer[row].value();
+    }
+
+    // Record a cross-strike hit if it pays after transaction costs; it is
+    // reported at the strike of leg[1]
+    template <class Book>
+    void addSpreadHit(Strategy strategy, uint32_t g, const uint32_t (&leg)[4],
+                      double edge, int num_options, Book& out) {
+        double cost = calculateTransactionCost(0, 0, num_options);
+        double profit = edge * option_point_value - cost;
+        if (profit <= 0) return;
+        ArbitrageOpportunity opp = {
+            strategy, g, {leg[0], leg[1], leg[2], leg[3]}, profit,
+            options.strike[leg[1]], groups[g].secid};
+        out.add(opp);
+    }
+
+    // Monotonicity, vertical-spread bounds and box spreads. Each is a
+    // condition on f(K1) + g(K2) for K1 < K2, so one pass keeping the best
+    // f over lower strikes finds the best partner of every strike: O(K).
+    template <class Book>
+    void scanSpreads(uint32_t g, const GroupScratch& s, Book& out) {
+        const ExpiryGroup& group = groups[g];
+        // American legs can be exercised at once, so their vertical bounds
+        // are the undiscounted width, and boxes are not locked in
+        const double disc = group.american ? 1.0 : group.disc;
+        size_t n = s.K.size();
+        if (n < 2) return;
+        auto call = [&](size_t i) { return pairs[group.begin + i].call; };
+        auto put = [&](size_t i) { return pairs[group.begin + i].put; };
+
+        // Best lower-strike leg seen so far, by index
+        size_t min_call_ask = 0, max_put_bid = 0;
+        size_t max_call_bound = 0, min_put_bound = 0;
+        size_t max_long_box = 0, max_short_box = 0;
+        for (size_t j = 1; j < n; j++) {
+            size_t i = j - 1;
+            if (s.call_ask[i] < s.call_ask[min_call_ask]) min_call_ask = i;
+            if (s.put_bid[i] > s.put_bid[max_put_bid]) max_put_bid = i;
+            if (s.call_bid[i] + s.K[i] * disc >
+                s.call_bid[max_call_bound] + s.K[max_call_bound] * disc)
+                max_call_bound = i;
+            if (s.put_ask[i] - s.K[i] * disc <
+                s.put_ask[min_put_bound] - s.K[min_put_bound] * disc)
+                min_put_bound = i;
+            if (s.put_bid[i] - s.call_ask[i] - s.K[i] * disc >
+                s.put_bid[max_long_box] - s.call_ask[max_long_box] -
+                    s.K[max_long_box] * disc)
+                max_long_box = i;
+            if (s.call_bid[i] - s.put_ask[i] + s.K[i] * disc >
+                s.call_bid[max_short_box] - s.put_ask[max_short_box] +
+                    s.K[max_short_box] * disc)
+                max_short_box = i;
+
+            // C(K1) >= C(K2): buy the cheaper lower call, sell the higher
+            size_t a = min_call_ask;
+            addSpreadHit(CALL_SPREAD_STRATEGY, g, {call(a), call(j)},
+                         s.call_bid[j] - s.call_ask[a], 2, out);
+
+            // P(K1) <= P(K2): sell the dearer lower put, buy the higher
+            a = max_put_bid;
+            addSpreadHit(PUT_SPREAD_STRATEGY, g, {put(a), put(j)},
+                         s.put_bid[a] - s.put_ask[j], 2, out);
+
+            // C(K1) - C(K2) <= (K2 - K1) e^(-rT)
+            a = max_call_bound;
+            addSpreadHit(CALL_VERTICAL_STRATEGY, g, {call(a), call(j)},
+                         s.call_bid[a] - s.call_ask[j] -
+                             (s.K[j] - s.K[a]) * disc,
+                         2, out);
+
+            // P(K2) - P(K1) <= (K2 - K1) e^(-rT)
+            a = min_put_bound;
+            addSpreadHit(PUT_VERTICAL_STRATEGY, g, {put(a), put(j)},
+                         s.put_bid[j] - s.put_ask[a] -
+                             (s.K[j] - s.K[a]) * disc,
+                         2, out);
+
+            if (group.american) continue;
+
+            // A long box pays K2 - K1 at expiry
+            a = max_long_box;
+            addSpreadHit(LONG_BOX_STRATEGY, g,
+                         {call(a), call(j), put(a), put(j)},
+                         (s.K[j] - s.K[a]) * disc - s.call_ask[a] +
+                             s.call_bid[j] - s.put_ask[j] + s.put_bid[a],
+                         4, out);
+
+            // A short box owes K2 - K1 at expiry
+            a = max_short_box;
+            addSpreadHit(SHORT_BOX_STRATEGY, g,
+                         {call(a), call(j), put(a), put(j)},
+                         s.call_bid[a] - s.call_ask[j] + s.put_bid[j] -
+                             s.put_ask[a] - (s.K[j] - s.K[a]) * disc,
+                         4, out);
+        }
+    }
 
-        for (const auto& opt : options) {
-            options_by_strike[opt.strike].push_back(opt);
+    // Convexity: no body may be sold above the chord of two wings bought
+    // at the ask. The cheapest chord under each strike is the lower convex
+    // hull of (K, ask), built in one pass, so the scan is O(K) as well.
+    template <class Book>
+    void scanButterflies(uint32_t g, const double* K, const double* bid,
+                         const double* ask, bool calls, vector<uint32_t>& hull,
+                         Book& out) {
+        const ExpiryGroup& group = groups[g];
+        size_t n = group.end - group.begin;
+        if (n < 3) return;
+        auto row = [&](size_t i) {
+            return calls ? pairs[group.begin + i].call
+                         : pairs[group.begin + i].put;
+        };
+
+        hull.clear();
+        for (uint32_t i = 0; i < n; i++) {
+            while (hull.size() >= 2) {
+                uint32_t o = hull[hull.size() - 2], a = hull.back();
+                double cross = (K[a] - K[o]) * (ask[i] - ask[o]) -
+                               (ask[a] - ask[o]) * (K[i] - K[o]);
+                if (cross > 0) break;
+                hull.pop_back();
+            }
+            hull.push_back(i);
         }
 
-        cout << "\nScanning for arbitrage opportunities...\n";
-        cout << "====================================\n";
+        // A hull vertex sits below every chord, and its bid below its ask
+        size_t h = 0;
+        for (size_t j = 1; j + 1 < n; j++) {
+            while (hull[h + 1] < j) h++;
+            if (hull[h + 1] == j) continue;
+            uint32_t a = hull[h], b = hull[h + 1];
+            double lambda = (K[b] - K[j]) / (K[b] - K[a]);
+            double chord = lambda * ask[a] + (1 - lambda) * ask[b];
+            addSpreadHit(calls ? CALL_BUTTERFLY_STRATEGY
+                               : PUT_BUTTERFLY_STRATEGY,
+                         g, {row(a), row(j), row(b)}, bid[j] - chord, 3, out);
+        }
+    }
 
-        for (const auto& [strike, strike_options] : options_by_strike) {
-            OptionData call, put;
-            bool has_call = false, has_put = false;
-
-            // Find call and put with same strike
-            for (const auto& opt : strike_options) {
-                if (opt.cp_flag == 'C' && !has_call) {
-                    call = opt;
-                    has_call = true;
-                } else if (opt.cp_flag == 'P' && !has_put) {
-                    put = opt;
-                    has_put = true;
-                }
+    // Gather a group's pairs into contiguous arrays
+    void gatherGroup(uint32_t g, GroupScratch& scratch) {
+        const ExpiryGroup& group = groups[g];
+        size_t n = group.end - group.begin;
+        scratch.K.resize(n);
+        scratch.call_bid.resize(n);
+        scratch.call_ask.resize(n);
+        scratch.put_bid.resize(n);
+        scratch.put_ask.resize(n);
+        for (size_t i = 0; i < n; i++) {
+            auto [call, put] = pairs[group.begin + i];
+            scratch.K[i] = strikeOf(call);
+            scratch.call_bid[i] = bidOf(call);
+            scratch.call_ask[i] = askOf(call);
+            scratch.put_bid[i] = bidOf(put);
+            scratch.put_ask[i] = askOf(put);
+        }
+    }
+
+    void scanExpiryGroup(uint32_t g, OpportunityBook& out,
+                         GroupScratch& scratch) {
+        PROFILE_STAGE(STAGE_SCAN_GROUP);
+        const ExpiryGroup& group = groups[g];
+        PROFILE_COUNT(PAIRS_CHECKED, group.end - group.begin);
+        gatherGroup(g, scratch);
+
+        // European parity is an equality; American pairs only have bounds
+        if (group.american) {
+            for (size_t i = group.begin; i < group.end; i++) {
+                scanAmericanBounds(g, pairs[i].call, pairs[i].put, out);
             }
+        } else {
+            scanParity(g, out, scratch);
+        }
 
-            if (has_call && has_put) {
-                cout << "Checking Strike: " << (strike / 1000.0) << endl;
+        // Scan across strikes
+        scanSpreads(g, scratch, out);
+        scanButterflies(g, scratch.K.data(), scratch.call_bid.data(),
+                        scratch.call_ask.data(), true, scratch.hull, out);
+        scanButterflies(g, scratch.K.data(), scratch.put_bid.data(),
+                        scratch.put_ask.data(), false, scratch.hull, out);
+    }
+
+    // Parity kernel over a gathered European group, then the full scan of
+    // the strikes it flags
+    void scanParity(uint32_t g, OpportunityBook& out, GroupScratch& scratch) {
+        const ExpiryGroup& group = groups[g];
+        size_t n = group.end - group.begin;
+        const MarketData& market = *group.market;
+        double S = market.has_index
+                       ? (market.index_bid + market.index_ask) / 2.0
+                       : NAN;
+        double F = market.has_future
+                       ? (market.future_bid + market.future_ask) / 2.0
+                       : NAN;
+        scratch.bits.resize(parityWords(n));
+        parityKernel(n, scratch.K.data(), scratch.call_bid.data(),
+                     scratch.call_ask.data(), scratch.put_bid.data(),
+                     scratch.put_ask.data(), group.disc, S, F,
+                     scratch.bits.data());
+
+        // Materialize only the strikes that failed a check
+        for (size_t w = 0; w < scratch.bits.size(); w += PARITY_CHECKS) {
+            const uint64_t* word = &scratch.bits[w];
+            uint64_t spot = word[0] | word[1], futures = word[2] | word[3];
+            for (uint64_t any = spot | futures; any; any &= any - 1) {
+                int bit = __builtin_ctzll(any);
+                auto [call, put] =
+                    pairs[group.begin + w / PARITY_CHECKS * 64 + bit];
 
                 // Scan Put-Call Parity
-                if (market.has_index) {
-                    scanPutCallParity(call, put);
+                if (spot >> bit & 1) {
+                    scanPutCallParity(g, call, put, out);
                 }
 
                 // Scan Put-Call-Futures Parity
-                if (market.has_future) {
-                    scanPutCallFuturesParity(call, put);
+                if (futures >> bit & 1) {
+                    scanPutCallFuturesParity(g, call, put, out);
                 }
             }
         }
     }
 
+    // Groups are sorted by secid, so the ends differ when several are loaded
+    bool multipleUnderlyings() const {
+        return !groups.empty() && groups.front().secid != groups.back().secid;
+    }
+
+    // Pair calls with puts and cut the pairs into expiry groups
+    void pairOptions() {
+        {
+            PROFILE_STAGE(STAGE_PAIR);
+            pairCallsAndPuts(options, pair_order, pairs);
+        }
+        {
+            PROFILE_STAGE(STAGE_GROUP);
+            groupByExpiry(options, pairs, groups);
+            joinMarketData();
+        }
+    }
+
+    // As-of join of the groups with the price histories: each quote date
+    // gets the latest index and futures closes at or before it. Groups are
+    // sorted by (secid, date), so one forward pass per underlying merges
+    // them with the ascending histories.
+    void joinMarketData() {
+        snapshots.clear();
+        snapshots.reserve(groups.size()); // keeps group.market valid
+        size_t index_at = 0, futures_at = 0;
+        for (size_t g = 0; g < groups.size(); g++) {
+            ExpiryGroup& group = groups[g];
+            bool new_secid = g == 0 || group.secid != groups[g - 1].secid;
+            if (new_secid) index_at = futures_at = 0;
+            if (new_secid || group.day != groups[g - 1].day) {
+                snapshots.push_back(historyOf(group.secid)
+                                        .quotesAt(group.day, index_at,
+                                                  futures_at));
+            }
+            group.market = &snapshots.back();
+        }
+    }
+
+    // Scan every expiry group into the opportunity book, passing the index
+    // of each scanned group to output if given; skipped[g] is set for a
+    // group output drops
+    void scanGroups(OutputPipeline<uint32_t>* output = nullptr,
+                    vector<atomic<bool>>* skipped = nullptr) {
+        // Groups are independent. Each underlying's groups are dealt to one
+        // worker, round robin over underlyings, and idle workers steal.
+        // They are pushed last first, so owners popping from the back scan
+        // them in order and output can print them as they finish.
+        WorkStealingPool pool(
+            min<size_t>(thread::hardware_concurrency(), groups.size()));
+        size_t shard = 0;
+        for (size_t g = groups.size(); g-- > 0;) {
+            if (g + 1 < groups.size() &&
+                groups[g].secid != groups[g + 1].secid) {
+                shard++;
+            }
+            pool.push(shard, g);
+        }
+
+        vector<OpportunityBook> found(pool.size());
+        vector<GroupScratch> scratch(pool.size());
+        pool.run([&](size_t w, size_t g) {
+            scanExpiryGroup(g, found[w], scratch[w]);
+            if (output && !output->push(w, uint32_t(g)))
+                (*skipped)[g] = true;
+        });
+        for (const auto& book : found) opportunities.merge(book);
+        PROFILE_COUNT(HITS, opportunities.hits);
+    }
+
+    // Expiry line and strikes of group g, as the scan reports it
+    void printGroup(size_t g) const {
+        const ExpiryGroup& group = groups[g];
+        if (multipleUnderlyings() &&
+            (g == 0 || group.secid != groups[g - 1].secid)) {
+            cout << "Underlying " << group.secid << '\n';
+        }
+        char date[11], exdate[11];
+        formatDaySerial(group.day, date);
+        formatDaySerial(group.expiry_day, exdate);
+        cout << "Expiry " << exdate << " (quoted " << date << ", T = "
+             << lround(group.T * days_per_year)
+             << " days): " << group.end - group.begin << " strikes\n";
+        for (size_t i = group.begin; i < group.end; i++) {
+            cout << "Checking Strike: " << strikeOf(pairs[i].call) << '\n';
+        }
+    }
+
+    // Check the O(K) cross-strike scans against every strike pair and
+    // triple of random small groups: the best profit of each strategy at
+    // each strike must agree
+    bool selfTest(int trials, uint64_t seed) {
+        struct StrategyBook {
+            map<pair<Strategy, StrikeTicks>, double> best;
+            void add(const ArbitrageOpportunity& opp) {
+                double& profit = best[{opp.strategy, opp.strike}];
+                profit = max(profit, opp.profit);
+            }
+        };
+        SplitMix64 rng = {seed};
+        MarketData market;
+        GroupScratch scratch;
+        int mismatches = 0;
+        size_t hits = 0;
+        for (int t = 0; t < trials; t++) {
+            // 2-12 strikes with wide, noisy quotes, so violations are common
+            size_t n = 2 + rng.next() % 11;
+            bool american = t % 2;
+            options = OptionChain();
+            pairs.clear();
+            int32_t strike = 1000 * 1000;
+            for (uint32_t i = 0; i < n; i++) {
+                strike += 1000 * (1 + rng.next() % 20);
+                for (char cp : {'C', 'P'}) {
+                    double mid = cp == 'C' ? 40.0 - 3 * i : 3.0 * i;
+                    mid = max(0.05, mid + 8 * (rng.uniform() - 0.5));
+                    double half = 2 * rng.uniform();
+                    int32_t bid = lround(max(0.0, mid - half) * 100);
+                    int32_t ask = lround((mid + half) * 100);
+                    options.push_back({2 * i + (cp == 'P'), 0, cp,
+                                       american ? 'A' : 'E', 1, 30, {strike},
+                                       {bid}, {ask}, 0});
+                }
+                pairs.push_back({2 * i, 2 * i + 1});
+            }
+            groups = {{0, n, 1, american, 0, 30, 30 / days_per_year,
+                       exp(-r * 30 / days_per_year), &market}};
+            gatherGroup(0, scratch);
+
+            StrategyBook fast, slow;
+            scanSpreads(0, scratch, fast);
+            scanButterflies(0, scratch.K.data(), scratch.call_bid.data(),
+                            scratch.call_ask.data(), true, scratch.hull,
+                            fast);
+            scanButterflies(0, scratch.K.data(), scratch.put_bid.data(),
+                            scratch.put_ask.data(), false, scratch.hull,
+                            fast);
+            bruteForceSpreads(0, scratch, slow);
+
+            bool same = fast.best.size() == slow.best.size();
+            for (auto a = fast.best.begin(), b = slow.best.begin();
+                 same && a != fast.best.end(); ++a, ++b) {
+                same = a->first == b->first &&
+                       fabs(a->second - b->second) < 1e-6;
+            }
+            if (!same) mismatches++;
+            hits += fast.best.size();
+        }
+
+        // Every parity trade, sized by strategyLegs() on random terms,
+        // must leave no delta
+        const Strategy parity[] = {PARITY_LONG_CALL_STRATEGY,
+                                   PARITY_SHORT_CALL_STRATEGY,
+                                   FUTURES_PARITY_LONG_CALL_STRATEGY,
+                                   FUTURES_PARITY_SHORT_CALL_STRATEGY,
+                                   AMERICAN_PARITY_LONG_CALL_STRATEGY,
+                                   AMERICAN_PARITY_SHORT_CALL_STRATEGY};
+        int unhedged = 0;
+        for (int t = 0; t < trials; t++) {
+            double S = 1000 + 4000 * rng.uniform(), T = 0.01 + rng.uniform();
+            double K = S * (0.5 + rng.uniform()), vol = 0.05 + rng.uniform();
+            double spot[2] = {S, S}, strike[2] = {K, K}, expiry[2] = {T, T};
+            double vols[2] = {vol, vol};
+            const char cp[2] = {'C', 'P'};
+            blackScholesGreeks(2, spot, strike, expiry, vols, cp, greeks);
+            for (Strategy strategy : parity) {
+                ArbitrageOpportunity opp = {strategy, 0, {0, 1}, 0, {}, 0};
+                PositionGreeks total;
+                if (!positionGreeks(opp, T, S * exp(r * T), total) ||
+                    fabs(total.delta) > 1e-6)
+                    unhedged++;
+            }
+        }
+        greeks = ChainGreeks();
+        options = OptionChain();
+        pairs.clear();
+        groups.clear();
+        cout << "Self-test: " << trials << " groups, " << hits
+             << " strategy hits, " << mismatches << " mismatches, "
+             << unhedged << " unhedged parity positions" << endl;
+        return mismatches == 0 && unhedged == 0;
+    }
+
+    // Every pair and triple of a gathered group, each strategy's edge
+    // written out as scanSpreads() and scanButterflies() define it
+    template <class Book>
+    void bruteForceSpreads(uint32_t g, const GroupScratch& s, Book& out) {
+        const ExpiryGroup& group = groups[g];
+        const double disc = group.american ? 1.0 : group.disc;
+        const vector<double>& K = s.K;
+        size_t n = K.size();
+        auto call = [&](size_t i) { return pairs[group.begin + i].call; };
+        auto put = [&](size_t i) { return pairs[group.begin + i].put; };
+        for (size_t a = 0; a < n; a++) {
+            for (size_t j = a + 1; j < n; j++) {
+                double width = (K[j] - K[a]) * disc;
+                addSpreadHit(CALL_SPREAD_STRATEGY, g, {call(a), call(j)},
+                             s.call_bid[j] - s.call_ask[a], 2, out);
+                addSpreadHit(PUT_SPREAD_STRATEGY, g, {put(a), put(j)},
+                             s.put_bid[a] - s.put_ask[j], 2, out);
+                addSpreadHit(CALL_VERTICAL_STRATEGY, g, {call(a), call(j)},
+                             s.call_bid[a] - s.call_ask[j] - width, 2, out);
+                addSpreadHit(PUT_VERTICAL_STRATEGY, g, {put(a), put(j)},
+                             s.put_bid[j] - s.put_ask[a] - width, 2, out);
+                if (group.american) continue;
+                addSpreadHit(LONG_BOX_STRATEGY, g,
+                             {call(a), call(j), put(a), put(j)},
+                             width - s.call_ask[a] + s.call_bid[j] -
+                                 s.put_ask[j] + s.put_bid[a],
+                             4, out);
+                addSpreadHit(SHORT_BOX_STRATEGY, g,
+                             {call(a), call(j), put(a), put(j)},
+                             s.call_bid[a] - s.call_ask[j] + s.put_bid[j] -
+                                 s.put_ask[a] - width,
+                             4, out);
+            }
+        }
+        for (size_t a = 0; a < n; a++) {
+            for (size_t j = a + 1; j < n; j++) {
+                for (size_t b = j + 1; b < n; b++) {
+                    double lambda = (K[b] - K[j]) / (K[b] - K[a]);
+                    addSpreadHit(CALL_BUTTERFLY_STRATEGY, g,
+                                 {call(a), call(j), call(b)},
+                                 s.call_bid[j] - lambda * s.call_ask[a] -
+                                     (1 - lambda) * s.call_ask[b],
+                                 3, out);
+                    addSpreadHit(PUT_BUTTERFLY_STRATEGY, g,
+                                 {put(a), put(j), put(b)},
+                                 s.put_bid[j] - lambda * s.put_ask[a] -
+                                     (1 - lambda) * s.put_ask[b],
+                                 3, out);
+                }
+            }
+        }
+    }
+
+    // Groups are printed by a writer thread while the workers scan. It
+    // keeps them in order, holding back groups that finish early. A
+    // dropped group is passed over, so it holds back later groups only
+    // until the writer's next record.
+    void scanArbitrageOpportunities() {
+        pairOptions();
+
+        cout << "\nScanning for arbitrage opportunities...\n";
+        cout << "====================================\n";
+
+        vector<char> scanned(groups.size(), 0);
+        vector<atomic<bool>> skipped(groups.size());
+        size_t printed = 0;
+        OutputPipeline<uint32_t> output(thread::hardware_concurrency(),
+                                        output_policy);
+        output.start([&](uint32_t g) {
+            scanned[g] = 1;
+            for (; printed < groups.size() &&
+                   (scanned[printed] || skipped[printed]);
+                 printed++) {
+                if (scanned[printed]) printGroup(printed);
+            }
+        });
+        scanGroups(&output, &skipped);
+        output.join();
+        for (; printed < groups.size(); printed++) {
+            if (scanned[printed]) printGroup(printed);
+        }
+        cout << flush;
+        output.printStats(cerr);
+    }
+
+    // "Long Call 3300.000000@12.500000": bought at the offer, sold at the bid
+    string formatLeg(bool is_long, const char* type, uint32_t row) const {
+        return string(is_long ? "Long " : "Short ") + type + " " +
+               to_string(strikeOf(row)) + "@" +
+               to_string(is_long ? askOf(row)
+                                 : bidOf(row));
+    }
+
+    // Human-readable legs of a hit, built only for displayed rows
+    string formatDetails(const ArbitrageOpportunity& opp) const {
+        uint32_t call = opp.leg[0], put = opp.leg[1];
+        const MarketData& market = *groups[opp.group].market;
+        switch (opp.strategy) {
+            case PARITY_LONG_CALL_STRATEGY:
+                return "Long Call@" + to_string(askOf(call)) +
+                       ", Short Put@" + to_string(bidOf(put)) +
+                       ", Short Index@" + to_string(market.index_bid);
+            case PARITY_SHORT_CALL_STRATEGY:
+                return "Short Call@" + to_string(bidOf(call)) +
+                       ", Long Put@" + to_string(askOf(put)) +
+                       ", Long Index@" + to_string(market.index_ask);
+            case FUTURES_PARITY_LONG_CALL_STRATEGY:
+                return "Long Call@" + to_string(askOf(call)) +
+                       ", Short Put@" + to_string(bidOf(put)) +
+                       ", Short Future@" + to_string(market.future_bid);
+            case FUTURES_PARITY_SHORT_CALL_STRATEGY:
+                return "Short Call@" + to_string(bidOf(call)) +
+                       ", Long Put@" + to_string(askOf(put)) +
+                       ", Long Future@" + to_string(market.future_ask);
+            case CALL_SPREAD_STRATEGY:
+            case CALL_VERTICAL_STRATEGY:
+                return formatLeg(opp.strategy == CALL_SPREAD_STRATEGY,
+                                 "Call", opp.leg[0]) +
+                       ", " +
+                       formatLeg(opp.strategy != CALL_SPREAD_STRATEGY,
+                                 "Call", opp.leg[1]);
+            case PUT_SPREAD_STRATEGY:
+            case PUT_VERTICAL_STRATEGY:
+                return formatLeg(opp.strategy == PUT_VERTICAL_STRATEGY,
+                                 "Put", opp.leg[0]) +
+                       ", " +
+                       formatLeg(opp.strategy != PUT_VERTICAL_STRATEGY,
+                                 "Put", opp.leg[1]);
+            case LONG_BOX_STRATEGY:
+            case SHORT_BOX_STRATEGY: {
+                bool is_long = opp.strategy == LONG_BOX_STRATEGY;
+                return formatLeg(is_long, "Call", opp.leg[0]) + ", " +
+                       formatLeg(!is_long, "Call", opp.leg[1]) + ", " +
+                       formatLeg(!is_long, "Put", opp.leg[2]) + ", " +
+                       formatLeg(is_long, "Put", opp.leg[3]);
+            }
+            case CALL_BUTTERFLY_STRATEGY:
+            case PUT_BUTTERFLY_STRATEGY: {
+                const char* type =
+                    opp.strategy == CALL_BUTTERFLY_STRATEGY ? "Call" : "Put";
+                double lambda = (strikeOf(opp.leg[2]) - strikeOf(opp.leg[1])) /
+                                (strikeOf(opp.leg[2]) - strikeOf(opp.leg[0]));
+                return to_string(lambda) + " x " +
+                       formatLeg(true, type, opp.leg[0]) + ", " +
+                       formatLeg(false, type, opp.leg[1]) + ", " +
+                       to_string(1 - lambda) + " x " +
+                       formatLeg(true, type, opp.leg[2]);
+            }
+            case AMERICAN_PARITY_LONG_CALL_STRATEGY:
+                return formatLeg(true, "Call", call) + ", " +
+                       formatLeg(false, "Put", put) + ", Short Index@" +
+                       to_string(market.index_bid);
+            case AMERICAN_PARITY_SHORT_CALL_STRATEGY:
+                return formatLeg(false, "Call", call) + ", " +
+                       formatLeg(true, "Put", put) + ", Long Index@" +
+                       to_string(market.index_ask);
+            case CALL_EXERCISE_STRATEGY:
+                return formatLeg(true, "Call", call) + ", Short Index@" +
+                       to_string(market.index_bid);
+            case PUT_EXERCISE_STRATEGY:
+                return formatLeg(true, "Put", call) + ", Long Index@" +
+                       to_string(market.index_ask);
+            default:
+                return "";
+        }
+    }
+
+    // Signed quantities of an opportunity's legs: option rows in leg order,
+    // then the index and futures legs. Those are sized like the parity
+    // trades, option_point_value dollars per point of index and disc of
+    // that per point of futures. Returns the number of option legs.
+    int strategyLegs(const ArbitrageOpportunity& opp, double option_qty[4],
+                     double& index_qty, double& futures_qty) const {
+        index_qty = futures_qty = 0;
+        switch (opp.strategy) {
+            case PARITY_LONG_CALL_STRATEGY:
+            case PARITY_SHORT_CALL_STRATEGY:
+            case FUTURES_PARITY_LONG_CALL_STRATEGY:
+            case FUTURES_PARITY_SHORT_CALL_STRATEGY:
+            case AMERICAN_PARITY_LONG_CALL_STRATEGY:
+            case AMERICAN_PARITY_SHORT_CALL_STRATEGY: {
+                bool long_call = opp.strategy == PARITY_LONG_CALL_STRATEGY ||
+                                 opp.strategy ==
+                                     FUTURES_PARITY_LONG_CALL_STRATEGY ||
+                                 opp.strategy ==
+                                     AMERICAN_PARITY_LONG_CALL_STRATEGY;
+                // The options make a synthetic forward, the third leg
+                // takes the other side
+                option_qty[0] = long_call ? 1 : -1;
+                option_qty[1] = -option_qty[0];
+                if (opp.strategy == FUTURES_PARITY_LONG_CALL_STRATEGY ||
+                    opp.strategy == FUTURES_PARITY_SHORT_CALL_STRATEGY)
+                    futures_qty = -option_qty[0];
+                else
+                    index_qty = -option_qty[0];
+                return 2;
+            }
+            case CALL_SPREAD_STRATEGY:
+            case PUT_VERTICAL_STRATEGY:
+                option_qty[0] = 1;
+                option_qty[1] = -1;
+                return 2;
+            case PUT_SPREAD_STRATEGY:
+            case CALL_VERTICAL_STRATEGY:
+                option_qty[0] = -1;
+                option_qty[1] = 1;
+                return 2;
+            case LONG_BOX_STRATEGY:
+            case SHORT_BOX_STRATEGY: {
+                double side = opp.strategy == LONG_BOX_STRATEGY ? 1 : -1;
+                option_qty[0] = option_qty[3] = side;
+                option_qty[1] = option_qty[2] = -side;
+                return 4;
+            }
+            case CALL_BUTTERFLY_STRATEGY:
+            case PUT_BUTTERFLY_STRATEGY: {
+                double lambda = (strikeOf(opp.leg[2]) - strikeOf(opp.leg[1])) /
+                                (strikeOf(opp.leg[2]) - strikeOf(opp.leg[0]));
+                option_qty[0] = lambda;
+                option_qty[1] = -1;
+                option_qty[2] = 1 - lambda;
+                return 3;
+            }
+            case CALL_EXERCISE_STRATEGY:
+            case PUT_EXERCISE_STRATEGY:
+                option_qty[0] = 1;
+                index_qty = opp.strategy == CALL_EXERCISE_STRATEGY ? -1 : 1;
+                return 1;
+            default:
+                return 0;
+        }
+    }
+
+    // Dollar Greeks of an opportunity summed over its legs, from
+    // computeGreeks(); false when a leg has none
+    bool positionGreeks(const ArbitrageOpportunity& opp,
+                        PositionGreeks& total) const {
+        double T, forward;
+        return greeks.delta.size() == options.size() &&
+               expiryTerms(opp.leg[0], T, forward) &&
+               positionGreeks(opp, T, forward, total);
+    }
+
+    // The same on the given expiry and forward
+    bool positionGreeks(const ArbitrageOpportunity& opp, double T,
+                        double forward, PositionGreeks& total) const {
+        double option_qty[4], index_qty, futures_qty;
+        int legs = strategyLegs(opp, option_qty, index_qty, futures_qty);
+        if (legs == 0) return false;
+
+        total = PositionGreeks();
+        double scale = option_point_value;
+        for (int l = 0; l < legs; l++) {
+            uint32_t row = opp.leg[l];
+            if (!isfinite(greeks.price[row])) return false;
+            double qty = option_qty[l] * scale;
+            total.delta += qty * greeks.delta[row];
+            total.gamma += qty * greeks.gamma[row];
+            total.vega += qty * greeks.vega[row] / 100;
+            total.rho += qty * greeks.rho[row] / 100;
+            total.theta += qty * greeks.theta[row] / days_per_year;
+        }
+        // The futures leg is futures_qty * scale * e^(-rT) dollars per point
+        // of F, in contracts of future_point_value. F = S e^(rT) moves
+        // e^(rT) points per index point, F T per unit of r and -r F per
+        // year as T runs down.
+        double carry = exp(r * T);
+        double contracts = futures_qty * scale / (carry * future_point_value);
+        double per_point = contracts * future_point_value;
+        total.delta += index_qty * scale + per_point * carry;
+        total.rho += per_point * forward * T / 100;
+        total.theta -= per_point * r * forward / days_per_year;
+        return true;
+    }
+
     void displayResults() {
+        PROFILE_STAGE(STAGE_DISPLAY);
         cout << "\n=== ARBITRAGE OPPORTUNITIES ===\n";
 
         if (opportunities.empty()) {
@@ -358,31 +2934,33 @@ class ArbitrageScanner {
             return;
         }
 
-        // Sort by profit (descending)
-        sort(opportunities.begin(), opportunities.end(),
-             [](const ArbitrageOpportunity& a, const ArbitrageOpportunity& b) {
-                 return a.profit > b.profit;
-             });
-
-        // Group by strike and show best opportunity for each strike
-        map<double, ArbitrageOpportunity> best_by_strike;
-
-        for (const auto& opp : opportunities) {
-            if (best_by_strike.find(opp.strike) == best_by_strike.end() ||
-                best_by_strike[opp.strike].profit < opp.profit) {
-                best_by_strike[opp.strike] = opp;
-            }
-        }
+        // Best opportunity of the most profitable strikes, by strike
+        vector<ArbitrageOpportunity> shown =
+            opportunities.top(max_displayed_opportunities);
 
         cout << fixed << setprecision(2);
         int count = 1;
 
-        for (const auto& [strike, opp] : best_by_strike) {
+        for (const auto& opp : shown) {
             if (opp.profit > 0) {
-                cout << count++ << ". Strike: " << strike << endl;
-                cout << "   Strategy: " << opp.strategy << endl;
+                cout << count++ << ". Strike: " << opp.strike.value();
+                if (multipleUnderlyings()) {
+                    cout << " (secid " << opp.secid << ")";
+                }
+                cout << endl;
+                cout << "   Strategy: " << strategy_names[opp.strategy]
+                     << endl;
                 cout << "   Net Profit: $" << opp.profit << endl;
-                cout << "   Details: " << opp.details << endl;
+                cout << "   Details: " << formatDetails(opp) << endl;
+                PositionGreeks position;
+                if (positionGreeks(opp, position)) {
+                    cout << "   Greeks: delta $" << position.delta
+                         << "/pt, gamma $" << position.gamma
+                         << "/pt^2, vega $" << position.vega
+                         << "/vol pt, rho $" << position.rho
+                         << "/%, theta $" << position.theta << "/day"
+                         << endl;
+                }
                 cout << "   ----------------------------------------" << endl;
             }
         }
@@ -390,17 +2968,651 @@ class ArbitrageScanner {
         if (count == 1) {
             cout << "No profitable arbitrage opportunities found after "
                     "transaction costs.\n";
+        } else {
+            cout << opportunities.hits << " hits, best per strike shown for "
+                 << count - 1 << " strikes" << endl;
+        }
+    }
+
+    // Ranges of pair_order, sorted by (secid, exercise_style, date,
+    // exdate, strike, cp_flag), that share an expiry. Given keep, the
+    // order is cut to the rows it marks first.
+    vector<pair<size_t, size_t>> expiryRuns(
+        const vector<bool>* keep = nullptr) {
+        pairCallsAndPuts(options, pair_order, pairs);
+        if (keep) {
+            auto dropped = [&](uint32_t row) { return !(*keep)[row]; };
+            pair_order.erase(
+                remove_if(pair_order.begin(), pair_order.end(), dropped),
+                pair_order.end());
+        }
+        vector<pair<size_t, size_t>> expiries;
+        for (size_t i = 0; i < pair_order.size();) {
+            uint32_t first = pair_order[i];
+            size_t end = i + 1;
+            while (end < pair_order.size() &&
+                   options.exdate[pair_order[end]] == options.exdate[first] &&
+                   options.date[pair_order[end]] == options.date[first] &&
+                   options.secid[pair_order[end]] == options.secid[first] &&
+                   options.exercise_style[pair_order[end]] ==
+                       options.exercise_style[first]) {
+                end++;
+            }
+            expiries.push_back({i, end});
+            i = end;
+        }
+        return expiries;
+    }
+
+    // Time to expiry and forward of the run starting with row first: the
+    // futures mid, or the index grown at r when no futures quote is loaded
+    bool expiryTerms(uint32_t first, double& T, double& forward) const {
+        int quote_day = options.date[first];
+        int expiry_day = options.exdate[first];
+        if (expiry_day <= quote_day) return false;
+        const MarketData market =
+            historyOf(options.secid[first]).quotesAt(quote_day);
+        if (!market.has_index && !market.has_future) return false;
+        double S = (market.index_bid + market.index_ask) / 2.0;
+        double F = (market.future_bid + market.future_ask) / 2.0;
+        T = (expiry_day - quote_day) / days_per_year;
+        forward = market.has_future ? F : S / exp(-r * T);
+        return true;
+    }
+
+    // Implied volatility of every option at bid, mid and ask, by inverting
+    // Black-76 on the forward of expiryTerms(). Expiries are solved in
+    // parallel. American quotes are first reduced by their early-exercise
+    // premium, priced on the lattice at the mid vol of a first pass.
+    void impliedVols(const vector<pair<size_t, size_t>>& expiries) {
+        size_t n = options.size();
+        iv_bid.assign(n, NAN);
+        iv_mid.assign(n, NAN);
+        iv_ask.assign(n, NAN);
+
+        atomic<size_t> next_expiry(0);
+        auto worker = [&]() {
+            vector<double> x, beta, s; // three quotes per option
+            vector<double> spot, strike, expiry, vol, premium;
+            vector<char> cp;
+            for (size_t e; (e = next_expiry++) < expiries.size();) {
+                PROFILE_STAGE(STAGE_IV_EXPIRY);
+                auto [begin, end] = expiries[e];
+                uint32_t first = pair_order[begin];
+                double T, forward;
+                if (!expiryTerms(first, T, forward)) continue;
+                double disc = exp(-r * T);
+
+                size_t m = 3 * (end - begin);
+                x.resize(m);
+                beta.resize(m);
+                s.resize(m);
+                premium.assign(end - begin, 0.0);
+                auto solve = [&]() {
+                    for (size_t j = 0; j < end - begin; j++) {
+                        uint32_t row = pair_order[begin + j];
+                        double K = strikeOf(row);
+                        double moneyness = log(forward / K);
+                        double scale = sqrt(forward * K);
+                        // Undiscounted call price through parity, then the
+                        // out-of-the-money side of the normalized Black curve
+                        double put_to_call = options.cp_flag[row] == 'P'
+                                                 ? forward - K
+                                                 : 0.0;
+                        double itm =
+                            moneyness > 0 ? 2 * sinh(moneyness / 2) : 0;
+                        double bid = bidOf(row) - premium[j];
+                        double ask = askOf(row) - premium[j];
+                        double quotes[3] = {bid, (bid + ask) / 2, ask};
+                        for (int q = 0; q < 3; q++) {
+                            x[3 * j + q] = -fabs(moneyness);
+                            beta[3 * j + q] =
+                                (quotes[q] / disc + put_to_call) / scale -
+                                itm;
+                        }
+                    }
+                    impliedTotalVols(m, x.data(), beta.data(), s.data());
+                };
+                solve();
+
+                if (options.exercise_style[first] == 'A') {
+                    // Early-exercise premiums at the first pass' mid vols,
+                    // then the European vols of what is left
+                    size_t count = end - begin;
+                    spot.assign(count, forward * disc);
+                    strike.resize(count);
+                    expiry.assign(count, T);
+                    vol.resize(count);
+                    cp.resize(count);
+                    for (size_t j = 0; j < count; j++) {
+                        uint32_t row = pair_order[begin + j];
+                        strike[j] = strikeOf(row);
+                        vol[j] = s[3 * j + 1] / sqrt(T);
+                        cp[j] = options.cp_flag[row];
+                    }
+                    earlyExercisePremiums(count, spot.data(), strike.data(),
+                                          expiry.data(), vol.data(),
+                                          cp.data(), premium.data());
+                    for (double& p : premium) p = isnan(p) ? 0.0 : p;
+                    solve();
+                }
+
+                double root_T = sqrt(T);
+                for (size_t j = 0; j < end - begin; j++) {
+                    uint32_t row = pair_order[begin + j];
+                    iv_bid[row] = s[3 * j] / root_T;
+                    iv_mid[row] = s[3 * j + 1] / root_T;
+                    iv_ask[row] = s[3 * j + 2] / root_T;
+                }
+            }
+        };
+        size_t workers = max<size_t>(
+            1, min<size_t>(thread::hardware_concurrency(), expiries.size()));
+        vector<thread> pool;
+        for (size_t w = 1; w < workers; w++) pool.emplace_back(worker);
+        worker();
+        for (auto& t : pool) t.join();
+    }
+
+    // Write the implied vols of impliedVols() as CSV
+    bool solveIVs(const string& filename) {
+        if (history.index.empty() && history.futures.empty() &&
+            underlyings.empty()) {
+            cout << "Error: Implied vols need index or futures data" << endl;
+            return false;
+        }
+
+        vector<pair<size_t, size_t>> expiries = expiryRuns();
+        auto start = chrono::steady_clock::now();
+        impliedVols(expiries);
+        double elapsed =
+            chrono::duration<double>(chrono::steady_clock::now() - start)
+                .count();
+
+        size_t n = options.size();
+        ofstream file(filename);
+        if (!file.is_open()) {
+            cout << "Error: Cannot open " << filename << endl;
+            return false;
         }
+        file << "option_id,date,exdate,cp_flag,strike,iv_bid,iv_mid,iv_ask\n";
+        file << setprecision(6);
+        for (size_t i = 0; i < n; i++) {
+            char date[11], exdate[11];
+            formatDaySerial(options.date[i], date);
+            formatDaySerial(options.exdate[i], exdate);
+            file << options.option_id[i] << ',' << date << ',' << exdate
+                 << ',' << options.cp_flag[i] << ','
+                 << strikeOf(i) << ',' << iv_bid[i] << ',' << iv_mid[i]
+                 << ',' << iv_ask[i] << '\n';
+        }
+
+        cout << "Implied vols for " << n << " options over "
+             << expiries.size() << " expiries in " << elapsed * 1e3
+             << " ms (" << (n ? elapsed * 1e9 / n : 0.0)
+             << " ns/option), written to " << filename << endl;
+        return true;
+    }
+
+    // Greeks of every option at its mid implied vol, on the spot implied
+    // by its expiry's forward; one blackScholesGreeks() batch per expiry
+    void computeGreeks() { computeGreeks(expiryRuns()); }
+
+    // The same for the legs displayResults() shows only, so the default
+    // report solves a few IVs and lattices rather than the whole chain
+    void computeDisplayedGreeks() {
+        vector<bool> shown(options.size(), false);
+        for (const auto& opp :
+             opportunities.top(max_displayed_opportunities)) {
+            double option_qty[4], index_qty, futures_qty;
+            int legs = strategyLegs(opp, option_qty, index_qty, futures_qty);
+            for (int l = 0; l < legs; l++) shown[opp.leg[l]] = true;
+        }
+        computeGreeks(expiryRuns(&shown));
+    }
+
+    void computeGreeks(const vector<pair<size_t, size_t>>& expiries) {
+        impliedVols(expiries);
+
+        size_t n = options.size();
+        for (int f = 0; f < GREEK_COUNT; f++)
+            (greeks.*greek_fields[f]).assign(n, NAN);
+        vector<uint32_t> rows;
+        vector<double> spot, K, expiry, vol;
+        vector<char> cp;
+        ChainGreeks batch;
+        for (auto [begin, end] : expiries) {
+            double T, forward;
+            if (!expiryTerms(pair_order[begin], T, forward)) continue;
+            rows.clear();
+            K.clear();
+            vol.clear();
+            cp.clear();
+            for (size_t j = begin; j < end; j++) {
+                uint32_t row = pair_order[j];
+                if (!isfinite(iv_mid[row])) continue;
+                rows.push_back(row);
+                K.push_back(strikeOf(row));
+                vol.push_back(iv_mid[row]);
+                cp.push_back(options.cp_flag[row]);
+            }
+            spot.assign(rows.size(), forward * exp(-r * T));
+            expiry.assign(rows.size(), T);
+            blackScholesGreeks(rows.size(), spot.data(), K.data(),
+                               expiry.data(), vol.data(), cp.data(), batch);
+            for (int f = 0; f < GREEK_COUNT; f++) {
+                const vector<double>& from = batch.*greek_fields[f];
+                vector<double>& to = greeks.*greek_fields[f];
+                for (size_t j = 0; j < rows.size(); j++)
+                    to[rows[j]] = from[j];
+            }
+        }
+    }
+
+    // Reprice every option by simulation at its mid implied vol and write
+    // the prices with their standard errors as CSV. European options of an
+    // expiry share `paths` paths; American puts get MC_LSM_PATHS paths of
+    // their own under Longstaff-Schwartz and run in parallel.
+    bool priceByMonteCarlo(const string& filename, size_t paths,
+                           uint64_t seed) {
+        if (history.index.empty() && history.futures.empty() &&
+            underlyings.empty()) {
+            cout << "Error: Monte Carlo prices need index or futures data"
+                 << endl;
+            return false;
+        }
+
+        vector<pair<size_t, size_t>> expiries = expiryRuns();
+        impliedVols(expiries);
+
+        size_t n = options.size();
+        vector<double> mc_price(n, NAN), std_error(n, NAN);
+        vector<double> spot(n, NAN), expiry(n, NAN);
+        vector<uint32_t> american; // rows for the Longstaff-Schwartz pass
+        vector<uint32_t> rows;
+        vector<double> K, vol, price, error;
+        vector<char> cp;
+
+        auto start = chrono::steady_clock::now();
+        for (size_t e = 0; e < expiries.size(); e++) {
+            auto [begin, end] = expiries[e];
+            uint32_t first = pair_order[begin];
+            double T, forward;
+            if (!expiryTerms(first, T, forward)) continue;
+
+            rows.clear();
+            K.clear();
+            vol.clear();
+            cp.clear();
+            for (size_t j = begin; j < end; j++) {
+                uint32_t row = pair_order[j];
+                if (!isfinite(iv_mid[row])) continue;
+                spot[row] = forward * exp(-r * T);
+                expiry[row] = T;
+                // Calls are never exercised early without dividends, so
+                // American ones are priced with the European options
+                if (options.exercise_style[row] == 'A' &&
+                    options.cp_flag[row] == 'P') {
+                    american.push_back(row);
+                    continue;
+                }
+                rows.push_back(row);
+                K.push_back(strikeOf(row));
+                vol.push_back(iv_mid[row]);
+                cp.push_back(options.cp_flag[row]);
+            }
+            if (rows.empty()) continue;
+
+            PROFILE_STAGE(STAGE_MC_EXPIRY);
+            price.resize(rows.size());
+            error.resize(rows.size());
+            monteCarloEuropean(rows.size(), forward * exp(-r * T), T,
+                               K.data(), vol.data(), cp.data(), paths, seed,
+                               uint32_t(e), price.data(), error.data());
+            for (size_t j = 0; j < rows.size(); j++) {
+                mc_price[rows[j]] = price[j];
+                std_error[rows[j]] = error[j];
+            }
+        }
+
+        // Streams are keyed by row, so any worker may take any option
+        atomic<size_t> next_option(0);
+        auto worker = [&]() {
+            vector<double> scratch;
+            for (size_t a; (a = next_option++) < american.size();) {
+                PROFILE_STAGE(STAGE_MC_AMERICAN);
+                uint32_t row = american[a];
+                longstaffSchwartz(spot[row], strikeOf(row), expiry[row],
+                                  iv_mid[row], options.cp_flag[row],
+                                  MC_LSM_PATHS, seed, row, mc_price[row],
+                                  std_error[row], scratch);
+            }
+        };
+        size_t workers = max<size_t>(
+            1, min<size_t>(thread::hardware_concurrency(), american.size()));
+        vector<thread> pool;
+        for (size_t w = 1; w < workers; w++) pool.emplace_back(worker);
+        worker();
+        for (auto& t : pool) t.join();
+        double elapsed =
+            chrono::duration<double>(chrono::steady_clock::now() - start)
+                .count();
+
+        ofstream file(filename);
+        if (!file.is_open()) {
+            cout << "Error: Cannot open " << filename << endl;
+            return false;
+        }
+        file << "option_id,date,exdate,cp_flag,exercise_style,strike,mid,"
+                "mc_price,std_error\n";
+        file << setprecision(8);
+        size_t priced = 0, outside = 0;
+        for (size_t i = 0; i < n; i++) {
+            double mid = (bidOf(i) + askOf(i)) / 2;
+            char date[11], exdate[11];
+            formatDaySerial(options.date[i], date);
+            formatDaySerial(options.exdate[i], exdate);
+            file << options.option_id[i] << ',' << date << ',' << exdate
+                 << ',' << options.cp_flag[i] << ','
+                 << options.exercise_style[i] << ',' << strikeOf(i) << ','
+                 << mid << ',' << mc_price[i] << ',' << std_error[i] << '\n';
+            if (isfinite(mc_price[i])) {
+                priced++;
+                outside += fabs(mc_price[i] - mid) > 3 * std_error[i];
+            }
+        }
+
+        cout << "Monte Carlo prices for " << priced << " options ("
+             << american.size() << " American) over " << expiries.size()
+             << " expiries in " << elapsed * 1e3 << " ms, written to "
+             << filename << endl;
+        cout << outside << " more than 3 standard errors from the mid"
+             << endl;
+        return true;
+    }
+
+    // Replay quote updates from a file, a named pipe or "-" (stdin).
+    // The book is seeded with the loaded chain; records are
+    //   D <date>                               session date
+    //   I <bid> <ask>                          index quote
+    //   F <bid> <ask>                          futures quote
+    //   O <exdate> <strike> <C|P> <bid> <ask>  option quote
+    bool streamQuotes(const string& source) {
+        ifstream file;
+        istream* in = &cin;
+        if (source != "-") {
+            file.open(source);
+            if (!file.is_open()) {
+                cout << "Error: Cannot open " << source << endl;
+                return false;
+            }
+            in = &file;
+        }
+
+        // The book follows the European options of one underlying, that of
+        // the first option row
+        StreamBook book;
+        int session_day = -1;
+        uint32_t secid = options.empty() ? 0 : options.secid[0];
+        for (size_t i = 0; i < options.size(); i++) {
+            uint32_t e, s;
+            if (options.secid[i] != secid || options.exercise_style[i] != 'E')
+                continue;
+            session_day = max<int>(session_day, options.date[i]);
+            book.slot(options.exdate[i], options.strike[i], e, s);
+            book.setQuote(e, s, options.cp_flag[i], bidOf(i), askOf(i));
+        }
+        book.setSessionDay(session_day);
+        const MarketData market = historyOf(secid).quotesAt(session_day);
+        if (market.has_index)
+            book.S = (market.index_bid + market.index_ask) / 2.0;
+        if (market.has_future)
+            book.F = (market.future_bid + market.future_ask) / 2.0;
+
+        vector<StreamHit> hits;
+        book.sweep(0, hits);
+        cout << "\nStreaming quotes from " << source << " ("
+             << hits.size() << " violations in the initial book)" << endl;
+        hits.clear();
+
+        LatencyHistogram latency;
+        uint64_t updates = 0, rejected = 0, raised = 0;
+        string line;
+        string_view tokens[6];
+        while (getline(*in, line)) {
+            if (line.empty() || line[0] == '#') continue;
+
+            PROFILE_STAGE(STAGE_STREAM_UPDATE);
+            auto start = chrono::steady_clock::now();
+            int count = splitTokens(line, tokens, 6);
+            bool applied =
+                applyStreamUpdate(book, tokens, count, updates + 1, hits);
+            auto stop = chrono::steady_clock::now();
+
+            if (!applied) {
+                rejected++;
+                continue;
+            }
+            updates++;
+            latency.record(
+                chrono::duration_cast<chrono::nanoseconds>(stop - start)
+                    .count());
+
+            // Report outside the timed section
+            for (const auto& hit : hits) {
+                const ExpiryBook& expiry = book.expiries[hit.expiry];
+                for (int c = 0; c < PARITY_CHECKS; c++) {
+                    if (!(hit.raised >> c & 1)) continue;
+                    raised++;
+                    char exdate[11];
+                    formatDaySerial(expiry.expiry_day, exdate);
+                    cout << "Update " << hit.update << ": Expiry "
+                         << exdate << " Strike "
+                         << expiry.strike[hit.slot].value() << ": "
+                         << strategy_names[c] << endl;
+                }
+            }
+            hits.clear();
+        }
+
+        cout << "Processed " << updates << " updates (" << rejected
+             << " rejected), " << raised << " new violations" << endl;
+        latency.print(cout);
+        return true;
+    }
+
+    // Answer OP_PARITY_SCAN requests on path, see serveRequests(). The
+    // chain is paired once; each request scans the groups it selects.
+    bool serveScans(const string& path) {
+        pairOptions();
+        cout << "Pricing service: " << groups.size() << " expiry groups"
+             << endl;
+        vector<GroupScratch> scratch(max(1u, thread::hardware_concurrency()));
+        auto handle = [&](size_t w, const WireHeader& request,
+                          string_view payload, string& reply) {
+            PROFILE_STAGE(STAGE_SERVE_REQUEST);
+            ScanQuery query;
+            if (request.op != OP_PARITY_SCAN) {
+                wireReply(reply, request.id, WIRE_UNKNOWN_OP, 0, nullptr, 0);
+                return;
+            }
+            if (request.count != 1 || payload.size() != sizeof(query)) {
+                wireReply(reply, request.id, WIRE_BAD_REQUEST, 0, nullptr, 0);
+                return;
+            }
+            memcpy(&query, payload.data(), sizeof(query));
+
+            OpportunityBook book;
+            bool matched = false;
+            for (size_t g = 0; g < groups.size(); g++) {
+                const ExpiryGroup& group = groups[g];
+                if ((query.secid && group.secid != query.secid) ||
+                    (query.day && group.day != query.day) ||
+                    (query.expiry_day && group.expiry_day != query.expiry_day))
+                    continue;
+                matched = true;
+                scanExpiryGroup(g, book, scratch[w]);
+            }
+            if (!matched) {
+                wireReply(reply, request.id, WIRE_NOT_FOUND, 0, nullptr, 0);
+                return;
+            }
+
+            size_t k = query.max_hits ? min<size_t>(query.max_hits, UINT16_MAX)
+                                      : max_displayed_opportunities;
+            vector<ArbitrageOpportunity> top = book.top(k);
+            vector<ScanHit> hits(top.size());
+            for (size_t i = 0; i < top.size(); i++) {
+                const ArbitrageOpportunity& opp = top[i];
+                hits[i].secid = opp.secid;
+                hits[i].day = DaySerial(groups[opp.group].day);
+                hits[i].expiry_day = DaySerial(groups[opp.group].expiry_day);
+                hits[i].strike = opp.strike.count;
+                hits[i].strategy = opp.strategy;
+                hits[i].profit = opp.profit;
+            }
+            wireReply(reply, request.id, WIRE_OK, hits.size(), hits.data(),
+                      sizeof(ScanHit));
+        };
+        return serveRequests(path, handle);
     }
 };
 
-int main() {
+// Benchmark ///////////////////////////////////////////////////////////////
+
+const size_t BENCH_MIN_ROWS = 1000, BENCH_MAX_ROWS = 10000000;
+const int BENCH_EXPIRIES = 10, BENCH_MAX_STRIKES = 500;
+const char* const BENCH_CHAIN_FILE = "bench_chain.txt";
+
+// Peak resident set size of the process in MB
+double peakRssMB() {
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+    return usage.ru_maxrss / 1048576.0; // bytes
+#else
+    return usage.ru_maxrss / 1024.0; // kilobytes
+#endif
+}
+
+// Generate chains of 1e3, 1e4, ... rows up to max_rows and time each stage
+// of a scan over them with the scan's own output discarded. The peak RSS
+// never drops, so sizes run in increasing order and each row shows the
+// high-water mark reached by the end of its stage.
+bool runBenchmark(size_t max_rows) {
+    cout << "Scanner benchmark, " << thread::hardware_concurrency()
+         << " hardware threads" << endl;
+    cout << setw(10) << "rows" << setw(10) << "stage" << setw(12) << "seconds"
+         << setw(14) << "rows/s" << setw(12) << "peak MB" << endl;
+
+    for (size_t target = BENCH_MIN_ROWS; target <= max_rows; target *= 10) {
+        ChainSpec spec;
+        spec.expiries = BENCH_EXPIRIES;
+        spec.strikes = int(min<size_t>(
+            BENCH_MAX_STRIKES, max<size_t>(1, target / (2 * spec.expiries))));
+        spec.dates = int(max<size_t>(
+            1, target / (2 * size_t(spec.expiries) * spec.strikes)));
+
+        ArbitrageScanner scanner;
+        MarketHistory market;
+        market.index.day = market.futures.day = {SYNTH_FIRST_DAY};
+        market.index.close = {SYNTH_SPOT};
+        market.futures.close = {SYNTH_SPOT * exp(r * 30 / days_per_year)};
+        scanner.setMarketHistory(market);
+
+        size_t rows = 0;
+        bool ok = true;
+        auto stage = [&](const char* name, auto&& run) {
+            auto start = chrono::steady_clock::now();
+            streambuf* saved = cout.rdbuf(nullptr);
+            run();
+            cout.rdbuf(saved);
+            cout.clear();
+            double seconds = chrono::duration<double>(
+                                 chrono::steady_clock::now() - start)
+                                 .count();
+            cout << setw(10) << rows << setw(10) << name << fixed
+                 << setprecision(4) << setw(12) << seconds << setprecision(0)
+                 << setw(14) << rows / max(seconds, 1e-9) << setprecision(1)
+                 << setw(12) << peakRssMB() << defaultfloat << endl;
+        };
+
+        stage("generate",
+              [&] { rows = generateChain(BENCH_CHAIN_FILE, spec); });
+        stage("load", [&] {
+            ok = rows > 0 && scanner.loadOptionsData(BENCH_CHAIN_FILE);
+        });
+        if (!ok) {
+            cout << "Error: Cannot benchmark " << BENCH_CHAIN_FILE << endl;
+            remove(BENCH_CHAIN_FILE);
+            return false;
+        }
+        stage("pair", [&] { scanner.pairOptions(); });
+        stage("scan", [&] { scanner.scanGroups(); });
+        stage("greeks", [&] { scanner.computeGreeks(); });
+        stage("report", [&] { scanner.displayResults(); });
+        cout << setw(10) << rows << setw(10) << "hits" << setw(12)
+             << scanner.hitCount() << endl;
+        remove(BENCH_CHAIN_FILE);
+    }
+    return true;
+}
+
+const int SELF_TEST_TRIALS = 10000;
+
+int main(int argc, char* argv[]) {
+    PROFILE_REPORT();
+    // --generate <file> [dates expiries strikes noise violation_rate seed]:
+    //   write a synthetic chain in the options file layout
+    // --bench [max_rows]: time load, pair, scan and report on such chains
+    // --self-test [trials seed]: check the cross-strike scans against
+    //   brute force on random small groups
+    if (argc > 2 && string(argv[1]) == "--generate") {
+        ChainSpec spec;
+        if (argc > 3) spec.dates = atoi(argv[3]);
+        if (argc > 4) spec.expiries = atoi(argv[4]);
+        if (argc > 5) spec.strikes = atoi(argv[5]);
+        if (argc > 6) spec.spread_noise = atof(argv[6]);
+        if (argc > 7) spec.violation_rate = atof(argv[7]);
+        if (argc > 8) spec.seed = strtoull(argv[8], nullptr, 10);
+        size_t rows = generateChain(argv[2], spec);
+        cout << "Wrote " << rows << " options to " << argv[2] << endl;
+        return rows > 0 ? 0 : 1;
+    }
+    if (argc > 1 && string(argv[1]) == "--bench") {
+        size_t max_rows =
+            argc > 2 ? strtoull(argv[2], nullptr, 10) : BENCH_MAX_ROWS;
+        return runBenchmark(max_rows) ? 0 : 1;
+    }
+    if (argc > 1 && string(argv[1]) == "--self-test") {
+        int trials = argc > 2 ? atoi(argv[2]) : SELF_TEST_TRIALS;
+        uint64_t seed = argc > 3 ? strtoull(argv[3], nullptr, 10) : 1;
+        ArbitrageScanner scanner;
+        return scanner.selfTest(trials, seed) ? 0 : 1;
+    }
+
     ArbitrageScanner scanner;
 
+    // --stream <file|pipe|->: replay quote updates instead of a single scan
+    // --iv <file>: write bid/mid/ask implied vols of the chain as CSV
+    // --mc <file> [paths seed]: write Monte Carlo prices at the mid vols
+    // --serve <socket>: keep the chain loaded and answer scan requests
+    // --drop-output: drop strike lines rather than stall the scan when the
+    //   console falls behind
+    // --greeks: compute Greeks for the whole chain, not only the legs shown
+    string mode, mode_arg;
+    if (argc > 2) {
+        mode = argv[1];
+        mode_arg = argv[2];
+    }
+    if (argc > 1 && string(argv[1]) == "--drop-output") {
+        scanner.setOutputPolicy(OUTPUT_DROP);
+    }
+    bool all_greeks = argc > 1 && string(argv[1]) == "--greeks";
+
     cout << "S&P 500 Options Arbitrage Scanner" << endl;
     cout << "==================================" << endl;
     cout << "Risk-free rate: " << (r * 100) << "%" << endl;
-    cout << "Time to maturity: " << (T * 365) << " days" << endl;
     cout << "Date: 2020-11-03" << endl << endl;
 
     // Load market data
@@ -424,6 +3636,9 @@ int main() {
         }
     }
 
+    // Optional per-underlying market files, see loadUnderlyings()
+    scanner.loadUnderlyings("underlyings.csv");
+
     // Try to load options data
     vector<string> options_files = {"wrds-www.wharton.upenn.edu.txt"};
     for (const string& file : options_files) {
@@ -433,6 +3648,10 @@ int main() {
         }
     }
 
+    if (mode == "--stream") {
+        return scanner.streamQuotes(mode_arg) ? 0 : 1;
+    }
+
     if (!options_loaded) {
         cout << "Error: Could not load options data. Please ensure the file "
                 "exists."
@@ -446,8 +3665,25 @@ int main() {
              << endl;
     }
 
+    if (mode == "--serve") {
+        return scanner.serveScans(mode_arg) ? 0 : 1;
+    }
+    if (mode == "--iv") {
+        return scanner.solveIVs(mode_arg) ? 0 : 1;
+    }
+    if (mode == "--mc") {
+        size_t paths = argc > 3 ? strtoull(argv[3], nullptr, 10) : MC_PATHS;
+        uint64_t seed = argc > 4 ? strtoull(argv[4], nullptr, 10) : 1;
+        return scanner.priceByMonteCarlo(mode_arg, paths, seed) ? 0 : 1;
+    }
+
     // Scan for arbitrage opportunities
     scanner.scanArbitrageOpportunities();
+    if (all_greeks) {
+        scanner.computeGreeks();
+    } else {
+        scanner.computeDisplayedGreeks();
+    }
 
     // Display results
     scanner.displayResults();
@@ -0,0 +1,182 @@
+// RFC 4180 tokenizer and numeric fields of Investing.com-style price files
+// ("11/03/2020","3,369.20",...,"1.66M","1.85%")
+#ifndef CSV_H
+#define CSV_H
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include <charconv>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// First delimiter or '\n' in [p, end), end if none. Sixteen bytes are
+// compared at a time; quoted text is searched with memchr instead.
+inline const char* findDelimiterOrNewline(const char* p, const char* end,
+                                          char delimiter) {
+#if defined(__SSE2__)
+    const __m128i delim = _mm_set1_epi8(delimiter);
+    const __m128i newline = _mm_set1_epi8('\n');
+    for (; end - p >= 16; p += 16) {
+        __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        int mask = _mm_movemask_epi8(_mm_or_si128(
+            _mm_cmpeq_epi8(chunk, delim), _mm_cmpeq_epi8(chunk, newline)));
+        if (mask) return p + __builtin_ctz(mask);
+    }
+#endif
+    for (; p < end; p++) {
+        if (*p == delimiter || *p == '\n') return p;
+    }
+    return end;
+}
+
+// Splits a buffer into records without copying. Fields are views into the
+// buffer with the enclosing quotes removed; a doubled quote inside stays
+// doubled (see unescapeCsvField()). Quoted fields may span lines, CRLF and
+// LF endings are both accepted and blank lines are skipped.
+class CsvReader {
+   public:
+    CsvReader(const char* data, size_t size, char delimiter = ',')
+        : pos(data), end(data + size), delimiter(delimiter) {}
+
+    // Fields of the next record, false at the end of the input
+    bool next(std::vector<std::string_view>& fields) {
+        fields.clear();
+        while (pos < end && (*pos == '\n' || *pos == '\r')) {
+            lines += *pos++ == '\n';
+        }
+        if (pos == end) return false;
+        record_line = lines + 1;
+
+        for (;;) {
+            std::string_view field;
+            if (*pos == '"') {
+                const char* start = ++pos;
+                const char* quote;
+                for (;;) {
+                    quote = static_cast<const char*>(
+                        memchr(pos, '"', end - pos));
+                    if (!quote) quote = end; // unterminated, take the rest
+                    if (quote + 1 < end && quote[1] == '"') {
+                        pos = quote + 2; // escaped quote
+                        continue;
+                    }
+                    break;
+                }
+                field = std::string_view(start, quote - start);
+                for (char c : field) lines += c == '\n';
+                // Anything between the closing quote and the delimiter is
+                // dropped
+                pos = findDelimiterOrNewline(quote + (quote < end), end,
+                                             delimiter);
+            } else {
+                const char* stop = findDelimiterOrNewline(pos, end, delimiter);
+                const char* last = stop;
+                if (last > pos && last[-1] == '\r' &&
+                    (last == end || *last == '\n'))
+                    last--;
+                field = std::string_view(pos, last - pos);
+                pos = stop;
+            }
+            fields.push_back(field);
+
+            if (pos < end && *pos == delimiter) {
+                pos++;
+                if (pos == end || *pos == '\n' || *pos == '\r') {
+                    fields.emplace_back(); // trailing empty field
+                    break;
+                }
+                continue;
+            }
+            break;
+        }
+        return true;
+    }
+
+    // 1-based line on which the last record returned by next() starts
+    size_t line() const { return record_line; }
+
+   private:
+    const char* pos;
+    const char* end;
+    char delimiter;
+    size_t lines = 0, record_line = 0;
+};
+
+// Field text with doubled quotes collapsed, for the rare fields that have
+// them
+inline std::string unescapeCsvField(std::string_view field) {
+    std::string text;
+    text.reserve(field.size());
+    for (size_t i = 0; i < field.size(); i++) {
+        text += field[i];
+        if (field[i] == '"' && i + 1 < field.size() && field[i + 1] == '"')
+            i++;
+    }
+    return text;
+}
+
+// Parse a number as price files print it: surrounding blanks, a sign,
+// thousands separators ("3,369.20"), a K/M/B multiplier ("1.66M") or a
+// percent sign ("1.85%", giving 0.0185). Up to 15 significant digits are
+// converted exactly in one division, longer ones through from_chars on a
+// stack buffer; nothing is allocated. False for empty or malformed text.
+inline bool parseCsvNumber(std::string_view text, double& value) {
+    static const double powers[] = {1e0,  1e1,  1e2,  1e3,  1e4,  1e5,
+                                    1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+                                    1e12, 1e13, 1e14, 1e15, 1e16, 1e17,
+                                    1e18, 1e19, 1e20, 1e21, 1e22};
+    const char* p = text.data();
+    const char* end = p + text.size();
+    while (p < end && (*p == ' ' || *p == '\t')) p++;
+    while (end > p && (end[-1] == ' ' || end[-1] == '\t')) end--;
+
+    char suffix = end > p ? end[-1] | 0x20 : 0; // lower case
+    double scale = suffix == 'k'   ? 1e3
+                   : suffix == 'm' ? 1e6
+                   : suffix == 'b' ? 1e9
+                                   : 1;
+    bool percent = end > p && end[-1] == '%';
+    if (scale != 1 || percent) end--;
+
+    bool negative = p < end && *p == '-';
+    if (p < end && (*p == '-' || *p == '+')) p++;
+
+    // Digits without separators, kept on the stack for the slow path
+    char digits[64];
+    int count = 0, fraction = -1, significant = 0;
+    uint64_t mantissa = 0;
+    for (; p < end; p++) {
+        char c = *p;
+        if (c >= '0' && c <= '9') {
+            if (count == int(sizeof(digits))) return false;
+            digits[count++] = c;
+            if (fraction >= 0) fraction++;
+            if (mantissa || c != '0') significant++;
+            if (significant <= 19) mantissa = mantissa * 10 + (c - '0');
+        } else if (c == '.' && fraction < 0) {
+            if (count == int(sizeof(digits))) return false;
+            digits[count++] = c;
+            fraction = 0;
+        } else if (c != ',' || fraction >= 0) {
+            return false;
+        }
+    }
+    if (count == (fraction >= 0)) return false; // no digits
+
+    if (significant <= 15 && fraction <= 22) {
+        value = fraction > 0 ? mantissa / powers[fraction] : double(mantissa);
+    } else if (std::from_chars(digits, digits + count, value).ptr !=
+               digits + count) {
+        return false;
+    }
+    value = (negative ? -value : value) * scale;
+    if (percent) value /= 100;
+    return true;
+}
+
+#endif
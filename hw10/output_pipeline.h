@@ -0,0 +1,197 @@
+// Bounded rings from compute workers to one writer thread, shared by the
+// options scanner and hw2's pricing report
+#ifndef OUTPUT_PIPELINE_H
+#define OUTPUT_PIPELINE_H
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <ostream>
+#include <thread>
+#include <vector>
+
+const int OUTPUT_IDLE_SPINS = 64; // empty polls before the writer parks
+
+// What a producer does with a record when its ring is full
+enum OutputPolicy {
+    OUTPUT_BLOCK, // wait for the writer (backpressure)
+    OUTPUT_DROP   // discard the record and count it
+};
+
+// Bounded single-producer/single-consumer ring of fixed-size records. Each
+// index is stored by one side only; the other side keeps a cached copy and
+// reloads it only when the ring looks full or empty.
+template <typename Record, size_t Capacity>
+class SpscRing {
+    static_assert((Capacity & (Capacity - 1)) == 0, "power of two");
+
+   public:
+    bool tryPush(const Record& record) {
+        size_t tail = write.load(std::memory_order_relaxed);
+        if (tail - read_seen == Capacity) {
+            read_seen = read.load(std::memory_order_acquire);
+            if (tail - read_seen == Capacity) return false;
+        }
+        slots[tail & (Capacity - 1)] = record;
+        write.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool tryPop(Record& record) {
+        size_t head = read.load(std::memory_order_relaxed);
+        if (head == write_seen) {
+            write_seen = write.load(std::memory_order_acquire);
+            if (head == write_seen) return false;
+        }
+        record = slots[head & (Capacity - 1)];
+        read.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Records waiting, as seen by the consumer
+    size_t depth() const {
+        return write.load(std::memory_order_acquire) -
+               read.load(std::memory_order_relaxed);
+    }
+
+   private:
+    alignas(64) std::atomic<size_t> write{0};
+    size_t read_seen = 0; // producer's copy of read
+    alignas(64) std::atomic<size_t> read{0};
+    size_t write_seen = 0; // consumer's copy of write
+    alignas(64) Record slots[Capacity];
+};
+
+// Carries result records from compute workers to one writer thread, one
+// ring per worker, so a worker never waits on the output stream unless
+// OUTPUT_BLOCK is chosen and the writer falls a full ring behind. Records
+// of different workers arrive in no particular order. An idle writer
+// yields for OUTPUT_IDLE_SPINS polls, then sleeps until the next push.
+template <typename Record, size_t Capacity = 1024>
+class OutputPipeline {
+   public:
+    OutputPipeline(size_t producers, OutputPolicy policy)
+        : lanes(std::max<size_t>(1, producers)), policy(policy) {}
+
+    ~OutputPipeline() { join(); }
+
+    // Run write(record) on the writer thread for every record pushed
+    // until close()
+    template <typename Writer>
+    void start(Writer write) {
+        writer = std::thread([this, write]() mutable {
+            Record record;
+            for (int spins = 0;;) {
+                bool closed = this->closed.load(std::memory_order_acquire);
+                bool idle = true;
+                for (Lane& lane : lanes) {
+                    while (lane.ring.tryPop(record)) {
+                        size_t depth = lane.ring.depth() + 1; // with record
+                        depth_sum += depth;
+                        max_depth = std::max(max_depth, depth);
+                        write(record);
+                        written++;
+                        idle = false;
+                    }
+                }
+                if (closed && idle) return; // every push was seen
+                if (!idle) {
+                    spins = 0;
+                } else if (++spins < OUTPUT_IDLE_SPINS) {
+                    std::this_thread::yield();
+                } else {
+                    park();
+                    spins = 0;
+                }
+            }
+        });
+    }
+
+    // Producer side; producer is the worker index, each owns one lane.
+    // False if the record was dropped under OUTPUT_DROP.
+    bool push(size_t producer, const Record& record) {
+        Lane& lane = lanes[producer % lanes.size()];
+        if (!lane.ring.tryPush(record)) {
+            if (policy == OUTPUT_DROP) {
+                lane.dropped++;
+                return false;
+            }
+            lane.stalls++;
+            while (!lane.ring.tryPush(record)) std::this_thread::yield();
+        }
+        wake();
+        return true;
+    }
+
+    // No more pushes; the writer drains the rings and stops
+    void close() {
+        closed.store(true, std::memory_order_release);
+        wake();
+    }
+
+    void join() {
+        close();
+        if (writer.joinable()) writer.join();
+    }
+
+    // Depth of the ring ahead of each record written and the full-ring
+    // events, after join()
+    void printStats(std::ostream& os) const {
+        size_t stalls = 0, dropped = 0;
+        for (const Lane& lane : lanes) {
+            stalls += lane.stalls;
+            dropped += lane.dropped;
+        }
+        os << "Output queue: " << written << " records over " << lanes.size()
+           << " rings of " << Capacity << ", depth mean "
+           << (written ? double(depth_sum) / written : 0.0) << " max "
+           << max_depth << ", " << stalls << " stalls, " << dropped
+           << " dropped" << std::endl;
+    }
+
+   private:
+    struct Lane {
+        SpscRing<Record, Capacity> ring;
+        size_t stalls = 0, dropped = 0; // producer's counters
+    };
+    std::vector<Lane> lanes;
+    OutputPolicy policy;
+    std::atomic<bool> closed{false};
+    std::thread writer;
+    size_t written = 0, depth_sum = 0, max_depth = 0; // writer's
+    std::mutex park_lock;
+    std::condition_variable parked_writer;
+    std::atomic<bool> parked{false};
+
+    // Writer side: sleep unless a record or close() came in meanwhile.
+    // Each side stores, fences, then loads what the other stored, so a
+    // push either is seen here or sees parked set.
+    void park() {
+        std::unique_lock<std::mutex> guard(park_lock);
+        parked.store(true, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        bool waiting = !closed.load(std::memory_order_relaxed);
+        for (const Lane& lane : lanes) waiting = waiting && !lane.ring.depth();
+        if (waiting) {
+            parked_writer.wait(guard, [this] {
+                return !parked.load(std::memory_order_relaxed);
+            });
+        }
+        parked.store(false, std::memory_order_relaxed);
+    }
+
+    // Producer side, after a push or close()
+    void wake() {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (!parked.load(std::memory_order_relaxed)) return;
+        {
+            std::lock_guard<std::mutex> guard(park_lock);
+            parked.store(false, std::memory_order_relaxed);
+        }
+        parked_writer.notify_one();
+    }
+};
+
+#endif
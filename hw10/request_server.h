@@ -0,0 +1,286 @@
+// Request server on a UNIX stream socket, shared by the options scanner
+// and hw2's bond pricing service. A resident process answers requests so
+// a client pays neither process startup nor the load of the data. Frames
+// are in native byte order without padding:
+//   request   WireHeader{size, id, op, count} + count request items
+//   reply     WireHeader{size, id, status, count} + count result items
+// where size counts the bytes after the header. All frames that arrive
+// before one poll() wake-up are served as a batch across workers, and
+// each connection gets its replies in request order. Each program keeps
+// its own ops and item layouts.
+#ifndef REQUEST_SERVER_H
+#define REQUEST_SERVER_H
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <condition_variable>
+#include <csignal>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+struct WireHeader {
+    uint32_t size;  // payload bytes
+    uint32_t id;    // chosen by the client, echoed in the reply
+    uint16_t op;    // request op, or WireStatus in a reply
+    uint16_t count; // items in the payload
+};
+static_assert(sizeof(WireHeader) == 12, "WireHeader is sent as is");
+
+enum WireStatus : uint16_t {
+    WIRE_OK,
+    WIRE_BAD_REQUEST, // payload does not match op and count
+    WIRE_UNKNOWN_OP,
+    WIRE_NOT_FOUND,   // no such item, or no data to answer it from
+    WIRE_NO_SOLUTION, // a solver found no root for an item
+};
+
+const uint32_t WIRE_MAX_PAYLOAD = 1 << 20; // larger frames drop the client
+
+// Header and items of a reply
+inline void wireReply(std::string& reply, uint32_t id, WireStatus status,
+                      size_t count, const void* items, size_t item_size) {
+    WireHeader header = {uint32_t(count * item_size), id, status,
+                         uint16_t(count)};
+    reply.append(reinterpret_cast<const char*>(&header), sizeof(header));
+    if (count) {
+        reply.append(static_cast<const char*>(items), count * item_size);
+    }
+}
+
+// Threads kept for the life of the server; run() wakes them for one batch
+// and returns when every job of it is done. The caller is worker 0.
+class BatchWorkers {
+   public:
+    BatchWorkers() {
+        size_t workers = std::max(1u, std::thread::hardware_concurrency());
+        for (size_t w = 1; w < workers; w++) {
+            threads.emplace_back([this, w] { work(w); });
+        }
+    }
+
+    ~BatchWorkers() {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (auto& t : threads) t.join();
+    }
+
+    // job(worker, j) for every j below jobs, each taken by the first free
+    // worker
+    void run(size_t jobs, const std::function<void(size_t, size_t)>& job) {
+        next = 0;
+        this->jobs = jobs;
+        this->job = &job;
+        bool shared = jobs > 1 && !threads.empty();
+        if (shared) {
+            {
+                std::lock_guard<std::mutex> guard(lock);
+                generation++;
+                pending = threads.size();
+            }
+            wake.notify_all();
+        }
+        take(0);
+        if (shared) {
+            std::unique_lock<std::mutex> guard(lock);
+            done.wait(guard, [&] { return pending == 0; });
+        }
+    }
+
+   private:
+    std::vector<std::thread> threads;
+    std::mutex lock;
+    std::condition_variable wake, done;
+    size_t generation = 0, pending = 0;
+    bool stopping = false;
+    std::atomic<size_t> next{0};
+    size_t jobs = 0;
+    const std::function<void(size_t, size_t)>* job = nullptr;
+
+    void take(size_t w) {
+        for (size_t j; (j = next++) < jobs;) (*job)(w, j);
+    }
+
+    void work(size_t w) {
+        for (size_t seen = 0;;) {
+            {
+                std::unique_lock<std::mutex> guard(lock);
+                wake.wait(guard,
+                          [&] { return stopping || generation != seen; });
+                if (stopping) return;
+                seen = generation;
+            }
+            take(w);
+            {
+                std::lock_guard<std::mutex> guard(lock);
+                if (--pending == 0) done.notify_one();
+            }
+        }
+    }
+};
+
+inline volatile std::sig_atomic_t stop_serving = 0;
+
+inline void requestStop(int) { stop_serving = 1; }
+
+// Serve path until SIGINT or SIGTERM. handle(worker, header, payload,
+// reply) runs on a batch worker and appends one reply frame; worker is
+// below max(1, hardware_concurrency()). A client that has closed its end
+// is only polled for output, and is closed once that drains.
+template <typename Handler>
+bool serveRequests(const std::string& path, Handler handle) {
+    sockaddr_un addr = {};
+    addr.sun_family = AF_UNIX;
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listener < 0 || path.size() >= sizeof(addr.sun_path)) {
+        std::cout << "Error: Cannot create a socket at " << path << std::endl;
+        if (listener >= 0) close(listener);
+        return false;
+    }
+    memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+    unlink(path.c_str()); // left by an earlier run
+    if (bind(listener, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) <
+            0 ||
+        listen(listener, SOMAXCONN) < 0) {
+        std::cout << "Error: Cannot listen on " << path << std::endl;
+        close(listener);
+        return false;
+    }
+    fcntl(listener, F_SETFL, O_NONBLOCK);
+    signal(SIGINT, requestStop);
+    signal(SIGTERM, requestStop);
+    std::cout << "Serving requests on " << path << std::endl;
+
+    struct Connection {
+        int fd;
+        std::string in, out;
+        size_t consumed = 0; // bytes of in cut into the batch
+        bool eof = false, failed = false;
+
+        explicit Connection(int fd) : fd(fd) {}
+    };
+    struct Job {
+        size_t client;
+        WireHeader header;
+        std::string_view payload; // into the client's input
+        std::string reply;
+    };
+    std::vector<Connection> clients;
+    std::vector<pollfd> fds;
+    std::vector<Job> batch;
+    uint64_t served = 0, batches = 0;
+    char buffer[1 << 16];
+    BatchWorkers workers;
+    std::function<void(size_t, size_t)> serve = [&](size_t w, size_t j) {
+        handle(w, batch[j].header, batch[j].payload, batch[j].reply);
+    };
+
+    while (!stop_serving) {
+        fds.assign(1, {listener, POLLIN, 0});
+        for (const auto& c : clients) {
+            short events = c.eof ? 0 : POLLIN;
+            if (!c.out.empty()) events |= POLLOUT;
+            fds.push_back({c.fd, events, 0});
+        }
+        if (poll(fds.data(), fds.size(), -1) < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+
+        // Read what the ready clients sent and cut the complete frames
+        batch.clear();
+        for (size_t i = 0; i < clients.size(); i++) {
+            Connection& c = clients[i];
+            while (!c.eof &&
+                   (fds[i + 1].revents & (POLLIN | POLLHUP | POLLERR))) {
+                ssize_t got = read(c.fd, buffer, sizeof(buffer));
+                if (got > 0) {
+                    c.in.append(buffer, got);
+                    continue;
+                }
+                if (got == 0) c.eof = true;
+                if (got < 0 && errno != EAGAIN && errno != EINTR)
+                    c.failed = true;
+                break;
+            }
+            for (c.consumed = 0;
+                 c.in.size() - c.consumed >= sizeof(WireHeader);) {
+                WireHeader header;
+                memcpy(&header, c.in.data() + c.consumed, sizeof(header));
+                if (header.size > WIRE_MAX_PAYLOAD) {
+                    c.failed = true;
+                    break;
+                }
+                size_t begin = c.consumed + sizeof(header);
+                if (c.in.size() - begin < header.size) break;
+                batch.push_back(
+                    {i, header,
+                     std::string_view(c.in.data() + begin, header.size),
+                     std::string()});
+                c.consumed = begin + header.size;
+            }
+        }
+
+        // Workers take the next frame of the batch until none is left
+        if (!batch.empty()) {
+            workers.run(batch.size(), serve);
+            for (const auto& job : batch) clients[job.client].out += job.reply;
+            served += batch.size();
+            batches++;
+        }
+
+        // Send what each socket takes; the rest waits for POLLOUT
+        for (auto& c : clients) {
+            c.in.erase(0, c.consumed);
+            while (!c.failed && !c.out.empty()) {
+                ssize_t sent =
+                    send(c.fd, c.out.data(), c.out.size(), MSG_NOSIGNAL);
+                if (sent > 0) {
+                    c.out.erase(0, sent);
+                } else {
+                    if (errno != EAGAIN && errno != EINTR) c.failed = true;
+                    break;
+                }
+            }
+        }
+        auto done = [](const Connection& c) {
+            bool finished = c.failed || (c.eof && c.out.empty());
+            if (finished) close(c.fd);
+            return finished;
+        };
+        clients.erase(std::remove_if(clients.begin(), clients.end(), done),
+                      clients.end());
+
+        if (fds[0].revents & POLLIN) {
+            for (int fd; (fd = accept(listener, nullptr, nullptr)) >= 0;) {
+                fcntl(fd, F_SETFL, O_NONBLOCK);
+                clients.emplace_back(fd);
+            }
+        }
+    }
+
+    for (const auto& c : clients) close(c.fd);
+    close(listener);
+    unlink(path.c_str());
+    std::cout << "Served " << served << " requests in " << batches
+              << " batches" << std::endl;
+    return true;
+}
+
+#endif
@@ -0,0 +1,38 @@
+// SplitMix64 generator of the synthetic data sets, shared by the options
+// scanner and hw2. A seed gives the same next() and uniform() stream on
+// every platform; normal() goes through std::log and std::cos, whose last
+// bits may differ between math libraries.
+#ifndef SPLITMIX64_H
+#define SPLITMIX64_H
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+
+struct SplitMix64 {
+    uint64_t state;
+
+    uint64_t next() {
+        uint64_t z = (state += 0x9e3779b97f4a7c15ull);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+        return z ^ (z >> 31);
+    }
+    double uniform() { return (next() >> 11) * 0x1.0p-53; } // [0, 1)
+    double normal() { // Box-Muller
+        double u = 1 - uniform(), v = uniform();
+        return std::sqrt(-2 * std::log(u)) * std::cos(2 * M_PI * v);
+    }
+
+    // Index drawn with the given weights, which sum to 1
+    template <size_t N>
+    size_t pick(const double (&weights)[N]) {
+        double u = uniform();
+        for (size_t i = 0; i + 1 < N; i++) {
+            if ((u -= weights[i]) < 0) return i;
+        }
+        return N - 1;
+    }
+};
+
+#endif
@@ -1,11 +1,31 @@
+#include <sys/resource.h>
+
+#if defined(__AVX512F__)
+#include <immintrin.h>
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
 #include <fstream>
 #include <iomanip>
 #include <iostream>
+#include <mutex>
 #include <sstream>
 #include <string>
+#include <string_view>
+#include <thread>
 #include <vector>
 
+#include "../hw10/output_pipeline.h"
+#include "../hw10/request_server.h"
+#include "../hw10/splitmix64.h"
+
 using namespace std;
 
 // const double YTM_range[12][2] = {{0.03, 0.04}, {0.07, 0.08}, {0.02, 0.03},
@@ -41,6 +61,7 @@ struct BondRecord {
     double offering_yield;
     Date delivery_date;
     double coupon;
+    int frequency; // coupons per year: 1, 2, 4 or 12
 };
 
 double f(double P, double FV, double c, int n, double r) {
@@ -64,10 +85,7 @@ double bisection(double P, double FV, double c, int n, double low, double high,
     } else if (high_value == 0) {
         return high;
     } else if (low_value * high_value > 0) {
-        // cout << "f(low) * f(high) > 0, ";
-        cout << "low_value = " << low_value << ", high_value = " << high_value
-             << endl;
-        return -1;
+        return -1; // no root between low and high
     }
 
     while (high - low >= error) {
@@ -114,38 +132,1081 @@ double Approx_YTM(double P, double FV, double C, int N) {
     return value;
 }
 
-// calculate the bond YTM
-double YTM(int half_year_diff, double coupon, double offering_price) {
+// calculate the bond YTM per coupon period, n coupons of c; -1 if
+// bisection() cannot bracket it
+double PeriodYTM(int n, double c, double offering_price) {
     double FV = 100;
 
-    double initial = Approx_YTM(offering_price, FV, coupon / 2, half_year_diff);
+    double initial = Approx_YTM(offering_price, FV, c, n);
 
     double range = 0.1;
-    double ytm = bisection(offering_price, FV, coupon / 2, half_year_diff,
-                           initial - range, initial + range, ERROR);
+    double ytm = bisection(offering_price, FV, c, n, initial - range,
+                           initial + range, ERROR);
     // double ytm_n =
-    //     newton(offering_price, FV, coupon / 2, half_year_diff, initial,
-    //     ERROR);
+    //     newton(offering_price, FV, c, n, initial, ERROR);
     // cout << "newton: " << ytm_n << endl;
     return ytm;
 }
 
-int main() {
-    cout << fixed << setprecision(5);
+// Conventions /////////////////////////////////////////////////////////////
+// Coupon frequency and day count are policy types, so every kernel below
+// is compiled once per convention with its period length folded into
+// constants. DispatchFrequency() picks the instantiation at run time, once
+// per group of bonds rather than inside the loops.
+template <int PerYear>
+struct Frequency {
+    static constexpr int per_year = PerYear;
+    static constexpr int months = 12 / PerYear; // per coupon period
+};
+typedef Frequency<1> Annual;
+typedef Frequency<2> Semiannual;
+typedef Frequency<4> Quarterly;
+typedef Frequency<12> Monthly;
+
+// run task(Freq()) with the Frequency of per_year; false if there is none
+template <typename Task>
+bool DispatchFrequency(int per_year, Task&& task) {
+    switch (per_year) {
+    case 1:
+        task(Annual());
+        return true;
+    case 2:
+        task(Semiannual());
+        return true;
+    case 4:
+        task(Quarterly());
+        return true;
+    case 12:
+        task(Monthly());
+        return true;
+    }
+    return false;
+}
+
+// days since 1970/1/1 (proleptic Gregorian calendar)
+int DaySerial(const Date& d) {
+    int y = d.digit[0], m = d.digit[1];
+    y -= m <= 2;
+    int era = (y >= 0 ? y : y - 399) / 400;
+    int yoe = y - era * 400;
+    int doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d.digit[2] - 1;
+    int doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return era * 146097 + doe - 719468;
+}
+
+// number of coupons, a partial first period counting as a whole one
+template <class Freq>
+int CouponPeriods(const Date& from, const Date& to) {
+    int year_diff = to.digit[0] - from.digit[0];
+    int month_diff = to.digit[1] - from.digit[1];
+    if (month_diff < 0) {
+        year_diff--;
+        month_diff += 12;
+    }
+    if (to.digit[2] - from.digit[2] < 0) {
+        month_diff--;
+    }
+    int total_month_diff = year_diff * 12 + month_diff;
+    return (total_month_diff + Freq::months - 1) / Freq::months;
+}
+
+// Share of the first coupon period left after settlement on the delivery
+// date. Actual/Actual takes the average actual period of the bond.
+struct ActualActual {
+    template <class Freq>
+    static double Omega(const BondRecord& rec, int n) {
+        int offering = DaySerial(rec.offering_date);
+        int settle = DaySerial(rec.delivery_date) - offering;
+        double period = double(DaySerial(rec.maturity) - offering) / n;
+        return (period - settle) / period;
+    }
+};
+
+// 30/360 counts every period as 360 / Freq::per_year days, so the number
+// of coupons does not enter.
+struct Thirty360 {
+    template <class Freq>
+    static double Omega(const BondRecord& rec, int) {
+        const double period = 360.0 / Freq::per_year;
+        int settle =
+            360 * (rec.delivery_date.digit[0] - rec.offering_date.digit[0]) +
+            30 * (rec.delivery_date.digit[1] - rec.offering_date.digit[1]) +
+            (rec.delivery_date.digit[2] - rec.offering_date.digit[2]);
+        return (period - settle) / period;
+    }
+};
+
+// annual YTM of n coupons at the offering price, -1 as PeriodYTM()
+template <class Freq>
+double YTM(int n, double coupon, double offering_price) {
+    double ytm = PeriodYTM(n, coupon / Freq::per_year, offering_price);
+    return ytm == -1 ? -1 : ytm * Freq::per_year;
+}
+
+// Nelson-Siegel-Svensson curve fitting ///////////////////////////////////
+// z(t) = b0 + b1 * L(t / tau1) + b2 * (L(t / tau1) - e^(-t / tau1))
+//           + b3 * (L(t / tau2) - e^(-t / tau2)),   L(x) = (1 - e^(-x)) / x
+// z is continuously compounded, so the discount factor is e^(-z(t) * t).
+const int NSS_PARAMS = 6;       // b0, b1, b2, b3, tau1, tau2
+const int LM_MAX_ITER = 100;    // Levenberg-Marquardt iterations per day
+const double NSS_MIN_TAU = 0.05; // keep the decay factors away from zero
+const int PARALLEL_BONDS = 128; // split the Jacobian across threads above this
+
+// all bonds offered on the same day, cash flows stored flat
+struct CurveDay {
+    Date date;
+    vector<double> price;     // market dirty price per bond
+    vector<int> cf_begin;     // bond i owns [cf_begin[i], cf_begin[i + 1])
+    vector<double> cf_time;   // years from the offering date
+    vector<double> cf_amount; // coupon (+ face value on the last one)
+};
+
+struct NormalEquations {
+    double JTJ[NSS_PARAMS][NSS_PARAMS];
+    double JTr[NSS_PARAMS];
+    double sse;
+};
+
+// z(t) and dz/dparam for one cash flow time
+double NSSRate(const double* b, double t, double* dz) {
+    double x1 = t / b[4], x2 = t / b[5];
+    double e1 = exp(-x1), e2 = exp(-x2);
+    // L(x) and L'(x), with the series expansion near zero
+    double L1 = x1 < 1e-8 ? 1 - x1 / 2 : (1 - e1) / x1;
+    double L2 = x2 < 1e-8 ? 1 - x2 / 2 : (1 - e2) / x2;
+    double dL1 = x1 < 1e-8 ? -0.5 : (e1 * (x1 + 1) - 1) / (x1 * x1);
+    double dL2 = x2 < 1e-8 ? -0.5 : (e2 * (x2 + 1) - 1) / (x2 * x2);
+
+    dz[0] = 1;
+    dz[1] = L1;
+    dz[2] = L1 - e1;
+    dz[3] = L2 - e2;
+    dz[4] = (b[1] * dL1 + b[2] * (dL1 + e1)) * (-x1 / b[4]);
+    dz[5] = b[3] * (dL2 + e2) * (-x2 / b[5]);
+    return b[0] + b[1] * dz[1] + b[2] * dz[2] + b[3] * dz[3];
+}
+
+// accumulate J^T J, J^T r and the squared error over bonds [begin, end)
+void AccumulateNormal(const CurveDay& day, const double* b, int begin, int end,
+                      NormalEquations& ne) {
+    for (int i = 0; i < NSS_PARAMS; i++) {
+        for (int j = 0; j < NSS_PARAMS; j++) ne.JTJ[i][j] = 0;
+        ne.JTr[i] = 0;
+    }
+    ne.sse = 0;
+
+    double dz[NSS_PARAMS];
+    for (int k = begin; k < end; k++) {
+        double model = 0;
+        double grad[NSS_PARAMS] = {0};
+        for (int c = day.cf_begin[k]; c < day.cf_begin[k + 1]; c++) {
+            double t = day.cf_time[c];
+            double z = NSSRate(b, t, dz);
+            double pv = day.cf_amount[c] * exp(-z * t);
+            model += pv;
+            for (int p = 0; p < NSS_PARAMS; p++) grad[p] -= pv * t * dz[p];
+        }
+        double residual = model - day.price[k];
+        ne.sse += residual * residual;
+        for (int i = 0; i < NSS_PARAMS; i++) {
+            ne.JTr[i] += grad[i] * residual;
+            for (int j = 0; j <= i; j++) ne.JTJ[i][j] += grad[i] * grad[j];
+        }
+    }
+    for (int i = 0; i < NSS_PARAMS; i++) {
+        for (int j = i + 1; j < NSS_PARAMS; j++) ne.JTJ[i][j] = ne.JTJ[j][i];
+    }
+}
+
+// Evaluates the normal equations of one day, in parallel across bonds for
+// large days. The bonds are split and the threads started once per fit;
+// each Build() wakes them for one evaluation and sums their parts.
+class NormalPool {
+   public:
+    explicit NormalPool(const CurveDay& day) : day(day) {
+        int bonds = day.price.size();
+        int workers = bonds < PARALLEL_BONDS
+                          ? 1
+                          : max(1u, thread::hardware_concurrency());
+        int chunk = (bonds + workers - 1) / workers;
+        for (int w = 0; w < workers; w++) {
+            int begin = min(bonds, w * chunk);
+            bounds.push_back({begin, min(bonds, begin + chunk)});
+        }
+        partial.resize(workers);
+        for (int w = 1; w < workers; w++) {
+            threads.emplace_back([this, w] { Work(w); });
+        }
+    }
+
+    ~NormalPool() {
+        {
+            lock_guard<mutex> guard(lock);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (auto& t : threads) t.join();
+    }
+
+    void Build(const double* b, NormalEquations& ne) {
+        {
+            lock_guard<mutex> guard(lock);
+            params = b;
+            generation++;
+            pending = threads.size();
+        }
+        wake.notify_all();
+        AccumulateNormal(day, b, bounds[0].first, bounds[0].second,
+                         partial[0]);
+        {
+            unique_lock<mutex> guard(lock);
+            done.wait(guard, [&] { return pending == 0; });
+        }
+
+        ne = partial[0];
+        for (size_t w = 1; w < partial.size(); w++) {
+            for (int i = 0; i < NSS_PARAMS; i++) {
+                for (int j = 0; j < NSS_PARAMS; j++) {
+                    ne.JTJ[i][j] += partial[w].JTJ[i][j];
+                }
+                ne.JTr[i] += partial[w].JTr[i];
+            }
+            ne.sse += partial[w].sse;
+        }
+    }
+
+   private:
+    const CurveDay& day;
+    vector<pair<int, int>> bounds; // bonds of each worker, 0 is the caller
+    vector<NormalEquations> partial;
+    vector<thread> threads;
+    mutex lock;
+    condition_variable wake, done;
+    const double* params = nullptr;
+    size_t generation = 0, pending = 0;
+    bool stopping = false;
+
+    void Work(int w) {
+        for (size_t seen = 0;;) {
+            const double* b;
+            {
+                unique_lock<mutex> guard(lock);
+                wake.wait(guard,
+                          [&] { return stopping || generation != seen; });
+                if (stopping) return;
+                seen = generation;
+                b = params;
+            }
+            AccumulateNormal(day, b, bounds[w].first, bounds[w].second,
+                             partial[w]);
+            lock_guard<mutex> guard(lock);
+            if (--pending == 0) done.notify_one();
+        }
+    }
+};
+
+// solve A x = y (Gaussian elimination with partial pivoting)
+bool Solve(double A[NSS_PARAMS][NSS_PARAMS], double* y, double* x) {
+    for (int c = 0; c < NSS_PARAMS; c++) {
+        int pivot = c;
+        for (int r = c + 1; r < NSS_PARAMS; r++) {
+            if (fabs(A[r][c]) > fabs(A[pivot][c])) pivot = r;
+        }
+        if (A[pivot][c] == 0) return false;
+        if (pivot != c) {
+            for (int k = 0; k < NSS_PARAMS; k++) swap(A[c][k], A[pivot][k]);
+            swap(y[c], y[pivot]);
+        }
+        for (int r = c + 1; r < NSS_PARAMS; r++) {
+            double m = A[r][c] / A[c][c];
+            for (int k = c; k < NSS_PARAMS; k++) A[r][k] -= m * A[c][k];
+            y[r] -= m * y[c];
+        }
+    }
+    for (int r = NSS_PARAMS - 1; r >= 0; r--) {
+        double value = y[r];
+        for (int k = r + 1; k < NSS_PARAMS; k++) value -= A[r][k] * x[k];
+        x[r] = value / A[r][r];
+    }
+    return true;
+}
+
+// Levenberg-Marquardt, b holds the warm start on entry and the fit on exit
+int FitNSS(const CurveDay& day, double* b, double& sse) {
+    NormalPool pool(day);
+    NormalEquations ne, trial_ne;
+    pool.Build(b, ne);
+    double lambda = 1e-3;
+    int iter = 0;
+
+    for (; iter < LM_MAX_ITER; iter++) {
+        double A[NSS_PARAMS][NSS_PARAMS], y[NSS_PARAMS], step[NSS_PARAMS];
+        for (int i = 0; i < NSS_PARAMS; i++) {
+            for (int j = 0; j < NSS_PARAMS; j++) A[i][j] = ne.JTJ[i][j];
+            // Marquardt scaling, floored so unidentified params stay put
+            A[i][i] += lambda * max(ne.JTJ[i][i], 1e-12);
+            y[i] = -ne.JTr[i];
+        }
+        if (!Solve(A, y, step)) {
+            lambda *= 10;
+            continue;
+        }
+
+        double trial[NSS_PARAMS];
+        for (int i = 0; i < NSS_PARAMS; i++) trial[i] = b[i] + step[i];
+        trial[4] = max(trial[4], NSS_MIN_TAU);
+        trial[5] = max(trial[5], NSS_MIN_TAU);
+        pool.Build(trial, trial_ne);
+
+        if (trial_ne.sse < ne.sse) {
+            double improvement = ne.sse - trial_ne.sse;
+            for (int i = 0; i < NSS_PARAMS; i++) b[i] = trial[i];
+            ne = trial_ne;
+            lambda = max(lambda / 10, 1e-12);
+            if (improvement <= ERROR * (1 + ne.sse)) break;
+        } else {
+            lambda *= 10;
+            if (lambda > 1e12) break;
+        }
+    }
+    sse = ne.sse;
+    return iter;
+}
+
+// append the cash flows of a bond from its offering date; coupons fall
+// every period counting back from maturity. Returns the accrued interest,
+// or -1 (nothing appended) for a bond without coupons left.
+template <class Freq>
+double AppendCashFlows(const BondRecord& rec, vector<double>& time,
+                       vector<double>& amount) {
+    const double period = 1.0 / Freq::per_year, c = rec.coupon / Freq::per_year;
+    int n = CouponPeriods<Freq>(rec.offering_date, rec.maturity);
+    double tenor =
+        (DaySerial(rec.maturity) - DaySerial(rec.offering_date)) / 365.25;
+    if (n <= 0 || tenor <= 0) return -1;
+
+    double first = tenor - (n - 1) * period;
+    for (int j = 0; j < n; j++) {
+        double t = first + j * period;
+        if (t <= 0) continue;
+        time.push_back(t);
+        amount.push_back(c + (j == n - 1 ? 100 : 0));
+    }
+    return first < period ? c * (period - first) / period : 0;
+}
+
+double AppendCashFlows(const BondRecord& rec, vector<double>& time,
+                       vector<double>& amount) {
+    double accrued = -1;
+    DispatchFrequency(rec.frequency, [&](auto freq) {
+        accrued = AppendCashFlows<decltype(freq)>(rec, time, amount);
+    });
+    return accrued;
+}
+
+// parameters fitted for one offering date
+struct FittedCurve {
+    int serial;
+    double b[NSS_PARAMS];
+};
+
+// fit one curve per offering date, each day warm-started from the previous,
+// and append them to curves in date order. Days with fewer bonds than NSS
+// parameters are underdetermined; they are listed but get no curve.
+int FitCurves(const vector<BondRecord>& records, vector<FittedCurve>& curves) {
+    vector<int> order(records.size());
+    vector<int> serial(records.size());
+    for (size_t i = 0; i < records.size(); i++) {
+        order[i] = i;
+        serial[i] = DaySerial(records[i].offering_date);
+    }
+    sort(order.begin(), order.end(),
+         [&](int a, int b) { return serial[a] < serial[b]; });
+
+    vector<CurveDay> days;
+    for (int i : order) {
+        const BondRecord& rec = records[i];
+        if (days.empty() || DaySerial(days.back().date) != serial[i]) {
+            days.emplace_back();
+            days.back().date = rec.offering_date;
+            days.back().cf_begin.push_back(0);
+        }
+        CurveDay& day = days.back();
+
+        double accrued = AppendCashFlows(rec, day.cf_time, day.cf_amount);
+        if (accrued < 0) continue;
+        day.price.push_back(rec.offering_price + accrued);
+        day.cf_begin.push_back(day.cf_time.size());
+    }
+
+    // first day starts flat at the average offering yield
+    double b[NSS_PARAMS] = {0, 0, 0, 0, 2.0, 10.0};
+    for (const auto& rec : records) b[0] += rec.offering_yield / 100;
+    if (!records.empty()) b[0] /= records.size();
+
+    cout << setw(12) << right << "Date" << setw(7) << "Bonds" << setw(6)
+         << "Iter" << setw(10) << "RMSE" << setw(10) << "b0" << setw(10)
+         << "b1" << setw(10) << "b2" << setw(10) << "b3" << setw(10)
+         << "tau1" << setw(10) << "tau2" << endl;
+
+    auto start = chrono::steady_clock::now();
+    int fitted = 0, skipped = 0;
+    for (const auto& day : days) {
+        int bonds = day.price.size();
+        if (bonds == 0) continue;
+        const Date& d = day.date;
+        cout << setw(6) << right << d.digit[0] << "/" << setw(2) << setfill('0')
+             << d.digit[1] << "/" << setw(2) << d.digit[2] << setfill(' ')
+             << setw(7) << bonds;
+        if (bonds < NSS_PARAMS) {
+            cout << "  skipped, fewer bonds than parameters" << endl;
+            skipped++;
+            continue;
+        }
+
+        double sse;
+        int iter = FitNSS(day, b, sse);
+        cout << setw(6) << iter << setw(10) << sqrt(sse / bonds);
+        for (int p = 0; p < NSS_PARAMS; p++) cout << setw(10) << b[p];
+        cout << endl;
+
+        FittedCurve curve;
+        curve.serial = DaySerial(d);
+        copy(b, b + NSS_PARAMS, curve.b);
+        curves.push_back(curve);
+        fitted++;
+    }
+    double seconds =
+        chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    cout << "Fitted " << fitted << " curves in " << seconds << " s, skipped "
+         << skipped << " days" << endl;
+    return 0;
+}
+
+// Mixed-precision YTM /////////////////////////////////////////////////////
+// Bulk screening solves YTM_LANES bonds at once in float32 (one AVX-512
+// register, or a lane loop elsewhere) with Newton steps from Approx_YTM(),
+// then polishes each yield with Newton steps in double, which bring it
+// back to the accuracy of YTM(). A bond whose last double step is still
+// above ERROR has not converged and is solved again by YTM(). Bonds are
+// sorted by the number of coupons so the lanes of a block run over about
+// the same periods.
+const int YTM_LANES = 16;
+const int YTM_FLOAT_STEPS = 4;  // float32 Newton steps per block
+const int YTM_DOUBLE_STEPS = 2; // double Newton steps per bond
+
+// one float32 Newton step on the per-period yield y of each lane: n coupons
+// of c per 100 face at price P, max_n the largest n of the block
+void FloatNewtonStep(int max_n, const int* n, const float* c, const float* P,
+                     float* y) {
+#if defined(__AVX512F__)
+    const __m512 one = _mm512_set1_ps(1), face = _mm512_set1_ps(100);
+    __m512i N = _mm512_loadu_si512(n);
+    __m512 C = _mm512_loadu_ps(c), Y = _mm512_loadu_ps(y);
+    __m512 v = _mm512_div_ps(one, _mm512_add_ps(one, Y));
+    __m512 vi = one, value = _mm512_setzero_ps(), slope = value;
+    for (int i = 1; i <= max_n; i++) {
+        __m512i I = _mm512_set1_epi32(i);
+        __m512 cf = _mm512_maskz_mov_ps(_mm512_cmple_epi32_mask(I, N), C);
+        cf = _mm512_mask_add_ps(cf, _mm512_cmpeq_epi32_mask(I, N), cf, face);
+        vi = _mm512_mul_ps(vi, v);
+        __m512 pv = _mm512_mul_ps(cf, vi);
+        value = _mm512_add_ps(value, pv);
+        slope = _mm512_fmadd_ps(_mm512_set1_ps(float(i)), pv, slope);
+    }
+    // y -= (value - P) / (-v * slope)
+    __m512 f = _mm512_sub_ps(value, _mm512_loadu_ps(P));
+    Y = _mm512_add_ps(Y, _mm512_div_ps(f, _mm512_mul_ps(v, slope)));
+    _mm512_storeu_ps(y, Y);
+#else
+    float v[YTM_LANES], vi[YTM_LANES], value[YTM_LANES], slope[YTM_LANES];
+    for (int l = 0; l < YTM_LANES; l++) {
+        v[l] = 1 / (1 + y[l]);
+        vi[l] = 1;
+        value[l] = slope[l] = 0;
+    }
+    for (int i = 1; i <= max_n; i++) {
+        for (int l = 0; l < YTM_LANES; l++) {
+            float cf = (i <= n[l] ? c[l] : 0) + (i == n[l] ? 100 : 0);
+            vi[l] *= v[l];
+            value[l] += cf * vi[l];
+            slope[l] += i * cf * vi[l];
+        }
+    }
+    for (int l = 0; l < YTM_LANES; l++) {
+        y[l] += (value[l] - P[l]) / (v[l] * slope[l]);
+    }
+#endif
+}
+
+// Newton steps in double from the float32 yield; last_step receives the
+// size of the final one
+double NewtonPolish(int n, double c, double P, double y, double& last_step) {
+    for (int step = 0; step < YTM_DOUBLE_STEPS; step++) {
+        double v = 1 / (1 + y), vi = 1, value = 0, slope = 0;
+        for (int i = 1; i <= n; i++) {
+            vi *= v;
+            double pv = (c + (i == n ? 100 : 0)) * vi;
+            value += pv;
+            slope += i * pv;
+        }
+        last_step = (value - P) / (v * slope);
+        y += last_step;
+    }
+    return y;
+}
+
+// per-period yields of n coupons of c per 100 face at price P, as
+// PeriodYTM() returns them. first_pass, if given, receives the float32
+// yields. Bonds whose Newton steps leave the domain or do not converge
+// fall back to PeriodYTM(); returns their number, of which unconverged,
+// if given, receives the second kind.
+int MixedYTM(const vector<int>& n, const vector<double>& c,
+             const vector<double>& P, vector<double>& y,
+             vector<double>* first_pass = nullptr,
+             int* unconverged = nullptr) {
+    int bonds = n.size();
+    vector<int> order(bonds);
+    for (int i = 0; i < bonds; i++) order[i] = i;
+    stable_sort(order.begin(), order.end(),
+                [&](int a, int b) { return n[a] < n[b]; });
+
+    y.resize(bonds);
+    if (first_pass) first_pass->resize(bonds);
+    int fallbacks = 0;
+    if (unconverged) *unconverged = 0;
+    for (int begin = 0; begin < bonds; begin += YTM_LANES) {
+        // gather a block; unused lanes repeat the last bond
+        int lane_n[YTM_LANES];
+        float lane_c[YTM_LANES], lane_P[YTM_LANES], lane_y[YTM_LANES];
+        int lanes = min(YTM_LANES, bonds - begin);
+        for (int l = 0; l < YTM_LANES; l++) {
+            int k = order[begin + min(l, lanes - 1)];
+            lane_n[l] = n[k];
+            lane_c[l] = c[k];
+            lane_P[l] = P[k];
+            lane_y[l] = Approx_YTM(P[k], 100, c[k], n[k]);
+        }
+        int max_n = n[order[begin + lanes - 1]];
+        for (int step = 0; step < YTM_FLOAT_STEPS; step++) {
+            FloatNewtonStep(max_n, lane_n, lane_c, lane_P, lane_y);
+        }
 
-    string filename = "qj2v53pmgqa0oh5p.csv";
+        for (int l = 0; l < lanes; l++) {
+            int k = order[begin + l];
+            if (first_pass) (*first_pass)[k] = lane_y[l];
+            double step;
+            double yield = NewtonPolish(n[k], c[k], P[k], lane_y[l], step);
+            bool diverged = !isfinite(yield) || yield <= -1;
+            if (diverged || !(fabs(step) <= ERROR)) {
+                if (!diverged && unconverged) ++*unconverged;
+                yield = PeriodYTM(n[k], c[k], P[k]);
+                fallbacks++;
+            }
+            y[k] = yield;
+        }
+    }
+    return fallbacks;
+}
+
+// solve every record's YTM with YTM() and with MixedYTM(), and report the
+// throughput of each and their largest difference
+int MixedYTMReport(const vector<BondRecord>& records) {
+    vector<int> n, per_year;
+    vector<double> c, P;
+    for (const auto& rec : records) {
+        DispatchFrequency(rec.frequency, [&](auto freq) {
+            typedef decltype(freq) Freq;
+            int periods = CouponPeriods<Freq>(rec.offering_date, rec.maturity);
+            if (periods <= 0) return;
+            n.push_back(periods);
+            per_year.push_back(Freq::per_year);
+            c.push_back(rec.coupon / Freq::per_year);
+            P.push_back(rec.offering_price);
+        });
+    }
+    int bonds = n.size();
+
+    auto start = chrono::steady_clock::now();
+    vector<double> exact(bonds);
+    for (int i = 0; i < bonds; i++) exact[i] = PeriodYTM(n[i], c[i], P[i]);
+    double double_seconds =
+        chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    start = chrono::steady_clock::now();
+    vector<double> mixed, first_pass;
+    int unconverged;
+    int fallbacks = MixedYTM(n, c, P, mixed, &first_pass, &unconverged);
+    double mixed_seconds =
+        chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    // annual yields, as main() prints them; bonds PeriodYTM() cannot
+    // bracket are left out
+    double float_error = 0, mixed_error = 0;
+    int compared = 0;
+    for (int i = 0; i < bonds; i++) {
+        if (exact[i] == -1) continue;
+        compared++;
+        float_error =
+            max(float_error, per_year[i] * fabs(first_pass[i] - exact[i]));
+        mixed_error = max(mixed_error, per_year[i] * fabs(mixed[i] - exact[i]));
+    }
+
+    cout << scientific << setprecision(3);
+    cout << "Bonds:             " << bonds << " (" << compared
+         << " bracketed by YTM())" << endl;
+    cout << "Double YTM():      " << bonds / double_seconds << " bonds/s"
+         << endl;
+    cout << "Mixed precision:   " << bonds / mixed_seconds << " bonds/s ("
+         << fallbacks << " fell back to YTM(), " << unconverged
+         << " of them unconverged)" << endl;
+    cout << "Max |float32 - YTM()|: " << float_error << endl;
+    cout << "Max |mixed - YTM()|:   " << mixed_error << endl;
+    return 0;
+}
+
+// Prices, durations and spreads ///////////////////////////////////////////
+
+// dirty and clean price of n coupons at the annual ytm, settled on the
+// delivery date
+template <class Freq, class DayCount>
+void DirtyCleanPrice(const BondRecord& rec, int n, double ytm, double& dirty,
+                     double& clean) {
+    const double c = rec.coupon / Freq::per_year, y = ytm / Freq::per_year;
+    double omega = DayCount::template Omega<Freq>(rec, n);
+
+    dirty = 0;
+    for (int j = 0; j < n; j++) {
+        dirty += c / pow(1 + y, j + omega);
+    }
+    dirty += 100 / pow(1 + y, n - 1 + omega);
+    clean = dirty - c * (1 - omega);
+}
+
+// Macaulay duration in years and modified duration of n coupons at the
+// annual ytm
+template <class Freq>
+void Durations(int n, double coupon, double ytm, double& macaulay,
+               double& modified) {
+    const double c = coupon / Freq::per_year, y = ytm / Freq::per_year;
+    double value = 0, weighted = 0;
+    for (int i = 1; i <= n; i++) {
+        double pv = (c + (i == n ? 100 : 0)) / pow(1 + y, i);
+        value += pv;
+        weighted += i * pv;
+    }
+    macaulay = weighted / value / Freq::per_year;
+    modified = macaulay / (1 + y);
+}
+
+// spread s over the NSS curve b that reprices the cash flows:
+// sum of amount * e^(-(z(t) + s) * t) = dirty price (Newton from s = 0)
+double ZSpread(const double* b, const vector<double>& time,
+               const vector<double>& amount, double price) {
+    vector<double> pv(time.size());
+    double dz[NSS_PARAMS];
+    for (size_t c = 0; c < time.size(); c++) {
+        pv[c] = amount[c] * exp(-NSSRate(b, time[c], dz) * time[c]);
+    }
+    double s = 0;
+    for (int iter = 0; iter < LM_MAX_ITER; iter++) {
+        double value = -price, slope = 0;
+        for (size_t c = 0; c < time.size(); c++) {
+            double v = pv[c] * exp(-s * time[c]);
+            value += v;
+            slope -= time[c] * v;
+        }
+        if (slope == 0) break;
+        double step = value / slope;
+        s -= step;
+        if (fabs(step) < ERROR) break;
+    }
+    return s;
+}
+
+// Pricing service /////////////////////////////////////////////////////////
+// --serve <socket> keeps the records and curves loaded and answers
+// requests over the framing of hw10/request_server.h, count BondQuery
+// per request. A result is 1 double for OP_YTM and OP_SPREAD, 4 for
+// OP_PRICE (dirty and clean Actual/Actual, then 30/360) and 2 for
+// OP_DURATION (Macaulay years, modified). A YTM that bisection() cannot
+// bracket fails the request with WIRE_NO_SOLUTION.
+
+enum WireOp : uint16_t {
+    OP_YTM = 1,  // annual YTM at value = price
+    OP_PRICE,    // prices at value = annual YTM
+    OP_DURATION, // durations at value = annual YTM
+    OP_SPREAD,   // spread over the offering date's curve at value = price
+};
+
+// one bond of a request; value <= 0 takes the bond's offering price, or
+// the YTM at that price
+struct BondQuery {
+    uint32_t bond; // row in the data file, from 0
+    uint32_t reserved;
+    double value;
+};
+static_assert(sizeof(BondQuery) == 16, "BondQuery is sent as is");
+
+// fit the curves once, then answer bond requests on path
+int Serve(const string& path, const vector<BondRecord>& records) {
+    vector<FittedCurve> curves;
+    FitCurves(records, curves);
+
+    auto handle = [&](size_t, const WireHeader& request, string_view payload,
+                      string& reply) {
+        int width = request.op == OP_PRICE      ? 4
+                    : request.op == OP_DURATION ? 2
+                    : request.op == OP_YTM || request.op == OP_SPREAD ? 1
+                                                                      : 0;
+        if (width == 0) {
+            wireReply(reply, request.id, WIRE_UNKNOWN_OP, 0, nullptr, 0);
+            return;
+        }
+        if (payload.size() != request.count * sizeof(BondQuery)) {
+            wireReply(reply, request.id, WIRE_BAD_REQUEST, 0, nullptr, 0);
+            return;
+        }
+
+        vector<double> results(request.count * width);
+        vector<double> time, amount;
+        for (int k = 0; k < request.count; k++) {
+            BondQuery query;
+            memcpy(&query, payload.data() + k * sizeof(query), sizeof(query));
+            if (query.bond >= records.size()) {
+                wireReply(reply, request.id, WIRE_NOT_FOUND, 0, nullptr, 0);
+                return;
+            }
+            const BondRecord& rec = records[query.bond];
+            double price = query.value > 0 ? query.value : rec.offering_price;
+            double* result = &results[k * width];
+
+            if (request.op == OP_SPREAD) {
+                int serial = DaySerial(rec.offering_date);
+                auto curve = lower_bound(
+                    curves.begin(), curves.end(), serial,
+                    [](const FittedCurve& c, int s) { return c.serial < s; });
+                time.clear();
+                amount.clear();
+                double accrued = AppendCashFlows(rec, time, amount);
+                if (curve == curves.end() || curve->serial != serial ||
+                    accrued < 0) {
+                    wireReply(reply, request.id, WIRE_NOT_FOUND, 0, nullptr,
+                              0);
+                    return;
+                }
+                result[0] = ZSpread(curve->b, time, amount, price + accrued);
+                continue;
+            }
+            bool solved = true;
+            DispatchFrequency(rec.frequency, [&](auto freq) {
+                typedef decltype(freq) Freq;
+                int n = CouponPeriods<Freq>(rec.offering_date, rec.maturity);
+                if (request.op == OP_YTM) {
+                    result[0] = YTM<Freq>(n, rec.coupon, price);
+                    solved = result[0] != -1;
+                    return;
+                }
+                double ytm = query.value > 0
+                                 ? query.value
+                                 : YTM<Freq>(n, rec.coupon, rec.offering_price);
+                solved = ytm != -1;
+                if (!solved) return;
+                if (request.op == OP_PRICE) {
+                    DirtyCleanPrice<Freq, ActualActual>(rec, n, ytm, result[0],
+                                                        result[1]);
+                    DirtyCleanPrice<Freq, Thirty360>(rec, n, ytm, result[2],
+                                                     result[3]);
+                } else {
+                    Durations<Freq>(n, rec.coupon, ytm, result[0], result[1]);
+                }
+            });
+            if (!solved) {
+                wireReply(reply, request.id, WIRE_NO_SOLUTION, 0, nullptr, 0);
+                return;
+            }
+        }
+        wireReply(reply, request.id, WIRE_OK, request.count, results.data(),
+                  width * sizeof(double));
+    };
+    return serveRequests(path, handle) ? 0 : 1;
+}
+
+// Result cache ////////////////////////////////////////////////////////////
+// The YTM and prices of each record are kept in CACHE_FILE between runs,
+// keyed by a hash of everything they depend on: the maturity, offering
+// and delivery (settlement) dates, the offering price, the coupon and its
+// frequency, and CACHE_VERSION, which stands for the conventions. A rerun
+// prices only the records whose key is new, and the file is rewritten
+// with the keys of this run.
+const char* const CACHE_FILE = "hw2_results.cache";
+const uint32_t CACHE_MAGIC = 0x43325748; // "HW2C"
+const uint32_t CACHE_VERSION = 2; // bump when the pricing changes
+
+struct CachedResult {
+    uint64_t key;
+    double ytm;      // annual
+    double dirty[2]; // Actual/Actual, 30/360
+    double clean[2];
+};
+
+// 64-bit FNV-1a of the pricing inputs
+uint64_t PricingKey(const BondRecord& rec) {
+    uint64_t hash = 0xcbf29ce484222325ull;
+    auto add = [&](const void* data, size_t size) {
+        const unsigned char* p = (const unsigned char*)data;
+        for (size_t i = 0; i < size; i++) {
+            hash = (hash ^ p[i]) * 0x100000001b3ull;
+        }
+    };
+    add(&CACHE_VERSION, sizeof(CACHE_VERSION));
+    add(rec.maturity.digit, sizeof(rec.maturity.digit));
+    add(rec.offering_date.digit, sizeof(rec.offering_date.digit));
+    add(rec.delivery_date.digit, sizeof(rec.delivery_date.digit));
+    add(&rec.offering_price, sizeof(rec.offering_price));
+    add(&rec.coupon, sizeof(rec.coupon));
+    add(&rec.frequency, sizeof(rec.frequency));
+    return hash;
+}
+
+// YTM at the offering price and the prices at that YTM of a bond paying
+// Freq coupons
+template <class Freq>
+void PriceRecord(const BondRecord& rec, CachedResult& result) {
+    int n = CouponPeriods<Freq>(rec.offering_date, rec.maturity);
+    result.key = PricingKey(rec);
+    result.ytm = YTM<Freq>(n, rec.coupon, rec.offering_price);
+    DirtyCleanPrice<Freq, ActualActual>(rec, n, result.ytm, result.dirty[0],
+                                        result.clean[0]);
+    DirtyCleanPrice<Freq, Thirty360>(rec, n, result.ytm, result.dirty[1],
+                                     result.clean[1]);
+}
+
+// entries sorted by key; an unreadable, outdated or damaged file is an
+// empty cache
+vector<CachedResult> LoadCache(const string& filename) {
+    vector<CachedResult> cache;
+    ifstream file(filename, ios::binary);
+    uint32_t header[2];
+    uint64_t count;
+    if (!file.read((char*)header, sizeof(header)) ||
+        !file.read((char*)&count, sizeof(count)) ||
+        header[0] != CACHE_MAGIC || header[1] != CACHE_VERSION) {
+        return cache;
+    }
+
+    // the count must describe exactly the rest of the file
+    streampos data = file.tellg();
+    file.seekg(0, ios::end);
+    uint64_t left = file.tellg() - data;
+    file.seekg(data);
+    if (!file || left % sizeof(CachedResult) != 0 ||
+        count != left / sizeof(CachedResult)) {
+        return cache;
+    }
+
+    cache.resize(count);
+    auto out_of_order = [](const CachedResult& a, const CachedResult& b) {
+        return a.key >= b.key;
+    };
+    if (!file.read((char*)cache.data(), count * sizeof(CachedResult)) ||
+        adjacent_find(cache.begin(), cache.end(), out_of_order) !=
+            cache.end()) {
+        cache.clear();
+    }
+    return cache;
+}
+
+bool FindCached(const vector<CachedResult>& cache, uint64_t key,
+                CachedResult& result) {
+    auto it = lower_bound(
+        cache.begin(), cache.end(), key,
+        [](const CachedResult& c, uint64_t k) { return c.key < k; });
+    if (it == cache.end() || it->key != key) return false;
+    result = *it;
+    return true;
+}
+
+// write through a temporary file, so an interrupted run keeps the old one
+void SaveCache(const string& filename, vector<CachedResult> cache) {
+    sort(cache.begin(), cache.end(),
+         [](const CachedResult& a, const CachedResult& b) {
+             return a.key < b.key;
+         });
+    cache.erase(unique(cache.begin(), cache.end(),
+                       [](const CachedResult& a, const CachedResult& b) {
+                           return a.key == b.key;
+                       }),
+                cache.end());
+
+    string temporary = filename + ".tmp";
+    ofstream file(temporary, ios::binary);
+    uint32_t header[2] = {CACHE_MAGIC, CACHE_VERSION};
+    uint64_t count = cache.size();
+    file.write((const char*)header, sizeof(header));
+    file.write((const char*)&count, sizeof(count));
+    file.write((const char*)cache.data(), count * sizeof(CachedResult));
+    file.close();
+    if (!file || rename(temporary.c_str(), filename.c_str()) != 0) {
+        cerr << "Cannot write the cache: " << filename << endl;
+        remove(temporary.c_str());
+    }
+}
+
+// Output pipeline /////////////////////////////////////////////////////////
+// Pricing workers hand the rows they have priced to one writer thread
+// through hw10/output_pipeline.h, so they never wait on cout unless
+// OUTPUT_BLOCK is chosen and the writer falls a full ring behind.
+const int PRICE_BLOCK = 64; // rows of one frequency a worker takes at once
+
+// report of record i, as main() prints it
+void PrintResult(int i, const BondRecord& rec, const CachedResult& result) {
+    cout << i + 1 << ". " << '\n';
+
+    cout << setw(20) << right << "YTM (calculated):" << setw(10) << right;
+    if (result.ytm == -1) {
+        cout << "no root" << '\n';
+    } else {
+        cout << result.ytm * 100 << '\n';
+    }
+    cout << setw(20) << right << "Offering Yield:" << setw(10) << right
+         << rec.offering_yield << '\n';
+    if (result.ytm == -1) return; // nothing to price at
+
+    // dirty price and clean price
+    const char* const basis_names[2] = {" Actual/Actual:", " 30/360:"};
+    for (int basis = 0; basis < 2; basis++) {
+        cout << basis_names[basis] << '\n';
+        cout << setw(20) << right << "Dirty Price:" << setw(10) << right
+             << result.dirty[basis] << '\n';
+        cout << setw(20) << right << "Clean Price:" << setw(10) << right
+             << result.clean[basis] << '\n';
+    }
+}
+
+// Report every record in order, taking unchanged ones from the cache and
+// pricing the others on worker threads in blocks of one coupon frequency.
+// The writer thread prints each row once the rows before it are in or
+// dropped, so a dropped report holds back later rows only until the
+// writer's next record. The dropped rows are listed on cerr. results
+// receives the results of the printed rows.
+// Returns the number of reused results.
+int PriceAndReport(const vector<BondRecord>& records,
+                   const vector<CachedResult>& cache,
+                   vector<CachedResult>& results, OutputPolicy policy) {
+    int rows = records.size();
+    results.assign(rows, CachedResult());
+    vector<char> ready(rows, 0);
+    vector<int> missed[13]; // rows by coupons per year
+    int reused = 0;
+    for (int i = 0; i < rows; i++) {
+        if (FindCached(cache, PricingKey(records[i]), results[i])) {
+            ready[i] = 1;
+            reused++;
+        } else {
+            missed[records[i].frequency].push_back(i);
+        }
+    }
+
+    // blocks in row order, so the writer can print while workers price
+    struct Block {
+        int per_year, begin, end; // range of missed[per_year]
+    };
+    vector<Block> blocks;
+    for (int per_year = 1; per_year <= 12; per_year++) {
+        int count = missed[per_year].size();
+        for (int b = 0; b < count; b += PRICE_BLOCK) {
+            blocks.push_back({per_year, b, min(b + PRICE_BLOCK, count)});
+        }
+    }
+    sort(blocks.begin(), blocks.end(), [&](const Block& a, const Block& b) {
+        return missed[a.per_year][a.begin] < missed[b.per_year][b.begin];
+    });
+
+    int workers = max<int>(
+        1, min<size_t>(thread::hardware_concurrency(), blocks.size()));
+    OutputPipeline<int> output(workers, policy); // rows priced
+    vector<atomic<bool>> skipped(rows); // set by a worker that drops a row
+    int printed = 0;
+    output.start([&](int row) {
+        ready[row] = 1;
+        for (; printed < rows && (ready[printed] || skipped[printed]);
+             printed++) {
+            if (!ready[printed]) continue;
+            PrintResult(printed, records[printed], results[printed]);
+        }
+    });
+
+    atomic<size_t> next(0);
+    vector<vector<int>> dropped(workers); // rows each worker could not push
+    auto work = [&](int w) {
+        for (size_t b; (b = next++) < blocks.size();) {
+            const Block& block = blocks[b];
+            DispatchFrequency(block.per_year, [&](auto freq) {
+                for (int k = block.begin; k < block.end; k++) {
+                    int row = missed[block.per_year][k];
+                    PriceRecord<decltype(freq)>(records[row], results[row]);
+                    if (!output.push(w, row)) {
+                        skipped[row] = true;
+                        dropped[w].push_back(row);
+                    }
+                }
+            });
+        }
+    };
+    vector<thread> threads;
+    for (int w = 1; w < workers; w++) threads.emplace_back(work, w);
+    work(0);
+    for (auto& t : threads) t.join();
+    output.join();
+
+    for (; printed < rows; printed++) {
+        if (ready[printed]) {
+            PrintResult(printed, records[printed], results[printed]);
+        }
+    }
+    cout << flush;
+    output.printStats(cerr);
+
+    // name the rows missing from the report by their numbers in it, runs
+    // of consecutive rows as first-last
+    vector<int> lost;
+    for (const auto& rows_of_worker : dropped) {
+        lost.insert(lost.end(), rows_of_worker.begin(), rows_of_worker.end());
+    }
+    if (!lost.empty()) {
+        sort(lost.begin(), lost.end());
+        cerr << "Dropped " << lost.size() << " rows from the report:";
+        for (size_t i = 0, j; i < lost.size(); i = j) {
+            for (j = i + 1; j < lost.size() && lost[j] == lost[j - 1] + 1;) {
+                j++;
+            }
+            cerr << ' ' << lost[i] + 1;
+            if (j - i > 1) cerr << '-' << lost[j - 1] + 1;
+        }
+        cerr << endl;
+    }
+
+    vector<CachedResult> kept;
+    for (int i = 0; i < rows; i++) {
+        if (ready[i]) kept.push_back(results[i]);
+    }
+    results.swap(kept);
+    return reused;
+}
+
+// bonds of a FISD extract in the hw2 layout, false if it cannot be opened
+bool ReadRecords(const string& filename, vector<BondRecord>& records) {
     ifstream file(filename);
 
     if (!file.is_open()) {
         cerr << "Cannot open the file: " << filename << endl;
-        return 1;
+        return false;
     }
 
     string line;
     getline(file, line); // skip the first line (header)
 
-    vector<BondRecord> records;
-
     while (getline(file, line)) { // read the file
         stringstream ss(line);
         string item;
@@ -202,140 +1263,296 @@ int main() {
         getline(ss, item, ',');
         record.coupon = stod(item);
 
+        // optional coupons per year, semiannual when absent
+        record.frequency = 2;
+        if (getline(ss, item, ',') && atoi(item.c_str()) > 0) {
+            record.frequency = atoi(item.c_str());
+        }
+        if (!DispatchFrequency(record.frequency, [](auto) {})) {
+            cerr << "Unsupported coupon frequency " << record.frequency
+                 << " for issuer " << record.issuer_id << endl;
+            continue;
+        }
+
         records.push_back(record);
     }
 
     file.close();
+    return true;
+}
 
-    // calculate the bond YTM
-    // Note: The bond is assumed to pay coupon semiannually
-    for (int i = 0; i < records.size(); i++) {
-        cout << i + 1 << ". " << endl;
-        BondRecord rec = records[i];
-
-        int year_diff = rec.maturity.digit[0] - rec.offering_date.digit[0];
-        int month_diff = rec.maturity.digit[1] - rec.offering_date.digit[1];
-        if (month_diff < 0) {
-            year_diff--;
-            month_diff += 12;
-        }
-        int day_diff = rec.maturity.digit[2] - rec.offering_date.digit[2];
-        if (day_diff < 0) {
-            month_diff--;
-            day_diff += 30; // assume 30 days in a month
-        }
-        int total_month_diff = year_diff * 12 + month_diff;
-        int half_year_diff = total_month_diff / 6;
-        if (total_month_diff % 6 != 0) {
-            half_year_diff++;
-        }
-
-        double ytm = YTM(half_year_diff, rec.coupon, rec.offering_price);
-        ytm *= 2;
-        cout << setw(20) << right << "YTM (calculated):" << setw(10) << right
-             << ytm * 100 << endl;
-        cout << setw(20) << right << "Offering Yield:" << setw(10) << right
-             << rec.offering_yield << endl;
-
-        // cout << "days_act: " << days_act << endl;
-
-        // calculate the dirty price and clean price
-        // actual/actual
-        cout << " Actual/Actual:" << endl;
-        int settle = 0;
-        Date start_day = rec.offering_date;
-        while (start_day.digit[0] != rec.delivery_date.digit[0] ||
-               start_day.digit[1] != rec.delivery_date.digit[1] ||
-               start_day.digit[2] != rec.delivery_date.digit[2]) {
-            settle++;
-            start_day.digit[2]++;
-            if (IsLeapYear(start_day.digit[0]) && start_day.digit[1] == 2) {
-                if (start_day.digit[2] > 29) {
-                    start_day.digit[2] = 1;
-                    start_day.digit[1]++;
-                }
-            } else if (start_day.digit[2] > MONTHS[start_day.digit[1] - 1]) {
-                start_day.digit[2] = 1;
-                start_day.digit[1]++;
-                if (start_day.digit[1] > 12) {
-                    start_day.digit[1] = 1;
-                    start_day.digit[0]++;
-                }
-            }
-        }
+// Synthetic bond universe /////////////////////////////////////////////////
+// FISD-shaped issues with tenors, coupons and frequencies drawn in roughly
+// the proportions of corporate issuance. Coupons sit on 1/8 steps over a
+// rate level that drifts with the offering year; the offering yield is
+// the coupon plus a small discount or premium, and the offering price is
+// that yield's price under the same conventions main() uses, so YTM()
+// recovers the yield to the price rounding.
+const int GEN_TENORS[] = {2, 3, 5, 7, 10, 15, 20, 30};
+const double GEN_TENOR_WEIGHTS[] = {0.08, 0.10, 0.24, 0.14,
+                                    0.22, 0.06, 0.06, 0.10};
+const int GEN_FREQUENCIES[] = {2, 4, 1, 12};
+const double GEN_FREQUENCY_WEIGHTS[] = {0.85, 0.08, 0.05, 0.02};
+const int GEN_FIRST_YEAR = 2000, GEN_YEARS = 24; // offering years
+const double GEN_ZERO_SHARE = 0.03;              // zero-coupon issues
+const int GEN_FIRST_ISSUER = 1000;
 
-        double duration = 0;
-        Date start_day_2 = rec.offering_date;
-        while (start_day_2.digit[0] != rec.maturity.digit[0] ||
-               start_day_2.digit[1] != rec.maturity.digit[1] ||
-               start_day_2.digit[2] != rec.maturity.digit[2]) {
-            duration++;
-            start_day_2.digit[2]++;
-            if (IsLeapYear(start_day_2.digit[0]) && start_day_2.digit[1] == 2) {
-                if (start_day_2.digit[2] > 29) {
-                    start_day_2.digit[2] = 1;
-                    start_day_2.digit[1]++;
-                }
-            } else if (start_day_2.digit[2] >
-                       MONTHS[start_day_2.digit[1] - 1]) {
-                start_day_2.digit[2] = 1;
-                start_day_2.digit[1]++;
-                if (start_day_2.digit[1] > 12) {
-                    start_day_2.digit[1] = 1;
-                    start_day_2.digit[0]++;
-                }
-            }
+// date d days after from, both as year, month, day
+void AddDays(const int from[3], int d, int to[3]) {
+    to[0] = from[0], to[1] = from[1], to[2] = from[2] + d;
+    for (;;) {
+        int days = MONTHS[to[1] - 1] + (to[1] == 2 && IsLeapYear(to[0]));
+        if (to[2] <= days) break;
+        to[2] -= days;
+        if (++to[1] > 12) to[1] = 1, to[0]++;
+    }
+}
+
+// Write rows bonds in the hw2 layout, or without the delivery date and
+// frequency columns in the hw3 layout. Returns the number written.
+size_t GenerateBonds(const string& filename, size_t rows, bool hw3_layout,
+                     uint64_t seed) {
+    ofstream file(filename, ios::binary);
+    if (!file.is_open()) {
+        cerr << "Cannot create the file: " << filename << endl;
+        return 0;
+    }
+    file << (hw3_layout ? "ISSUER_ID,MATURITY,OFFERING_DATE,OFFERING_PRICE,"
+                          "OFFERING_YIELD,COUPON\n"
+                        : "ISSUER_ID,MATURITY,OFFERING_DATE,OFFERING_PRICE,"
+                          "OFFERING_YIELD,DELIVERY_DATE,COUPON,FREQUENCY\n");
+
+    SplitMix64 rng{seed};
+    string buffer;
+    char line[160];
+    for (size_t row = 0; row < rows; row++) {
+        int offering[3], maturity[3], delivery[3];
+        offering[0] = GEN_FIRST_YEAR + int(rng.next() % GEN_YEARS);
+        offering[1] = 1 + int(rng.next() % 12);
+        offering[2] = 1 + int(rng.next() % 28);
+        int tenor = GEN_TENORS[rng.pick(GEN_TENOR_WEIGHTS)];
+        maturity[0] = offering[0] + tenor;
+        maturity[1] = offering[1];
+        maturity[2] = offering[2];
+        AddDays(offering, 1 + int(rng.next() % 7), delivery);
+        int per_year =
+            hw3_layout ? 2 : GEN_FREQUENCIES[rng.pick(GEN_FREQUENCY_WEIGHTS)];
+
+        // rate level of the offering year, a term premium and a credit
+        // spread capped at distressed levels; zero-coupon issues keep only
+        // the yield and are semiannual
+        double level = 5.5 - 0.2 * (offering[0] - GEN_FIRST_YEAR);
+        double spread = min(exp(0.3 + 0.6 * rng.normal()), 8.0);
+        double yield = max(0.25, level + 0.08 * tenor + spread);
+        double coupon = 0;
+        if (rng.uniform() >= GEN_ZERO_SHARE) {
+            coupon = max(0.125, round(yield * 8) / 8);
+            yield = max(0.05, coupon + 0.15 * rng.normal());
+        } else if (!hw3_layout) {
+            per_year = 2;
         }
-        duration /= half_year_diff;
-        // cout << "duration: " << duration << endl;
 
-        double omega = (duration - settle) / duration;
-        // cout << "days_to_next_payment_day: " << days_to_next_payment_day
-        //      << endl;
-        // cout << "omega: " << omega << endl;
-        double dirty_price = 0;
-        for (int j = 0; j < half_year_diff; j++) {
-            dirty_price += (rec.coupon / 2) / pow(1 + ytm / 2, j + omega);
+        int n = tenor * per_year;
+        double c = coupon / per_year, y = yield / 100 / per_year;
+        double price = 100 / pow(1 + y, n);
+        for (int i = 1; i <= n; i++) price += c / pow(1 + y, i);
+
+        int length;
+        if (hw3_layout) {
+            length = snprintf(line, sizeof(line),
+                              "%zu,%d/%d/%d,%d/%d/%d,%.3f,%.3f,%.3f\n",
+                              GEN_FIRST_ISSUER + row, maturity[0], maturity[1],
+                              maturity[2], offering[0], offering[1],
+                              offering[2], price, yield, coupon);
+        } else {
+            length = snprintf(
+                line, sizeof(line),
+                "%zu,%d/%d/%d,%d/%d/%d,%.3f,%.3f,%d/%d/%d,%.3f,%d\n",
+                GEN_FIRST_ISSUER + row, maturity[0], maturity[1], maturity[2],
+                offering[0], offering[1], offering[2], price, yield,
+                delivery[0], delivery[1], delivery[2], coupon, per_year);
         }
-        dirty_price += 100 / pow(1 + ytm / 2, half_year_diff - 1 + omega);
-        cout << setw(20) << right << "Dirty Price:" << setw(10) << right
-             << dirty_price << endl;
+        buffer.append(line, length);
+        if (buffer.size() > (1 << 20)) {
+            file.write(buffer.data(), buffer.size());
+            buffer.clear();
+        }
+    }
+    file.write(buffer.data(), buffer.size());
+    return file ? rows : 0;
+}
 
-        double accrued_interest = rec.coupon / 2 * (1 - omega);
-        double clean_price = dirty_price - accrued_interest;
-        cout << setw(20) << right << "Clean Price:" << setw(10) << right
-             << clean_price << endl;
+// Benchmark ///////////////////////////////////////////////////////////////
 
-        // 30/360 ///////////////////////////////////////////////////////
-        cout << " 30/360:" << endl;
+const size_t BENCH_MIN_ROWS = 1000, BENCH_MAX_ROWS = 1000000;
+const char* const BENCH_FILE = "bench_bonds.csv";
 
-        int days_30360 = 360 * year_diff + 30 * month_diff + day_diff;
-        // cout << "days_30360: " << days_30360 << endl;
+// peak resident set size of the process in MB
+double PeakRssMB() {
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+    return usage.ru_maxrss / 1048576.0; // bytes
+#else
+    return usage.ru_maxrss / 1024.0; // kilobytes
+#endif
+}
 
-        int settle_30360 =
-            360 * (rec.delivery_date.digit[0] - rec.offering_date.digit[0]) +
-            30 * (rec.delivery_date.digit[1] - rec.offering_date.digit[1]) +
-            (rec.delivery_date.digit[2] - rec.offering_date.digit[2]);
-        // cout << "settle_30360: " << settle_30360 << endl;
+// Generate universes of 1e3, 1e4, ... bonds up to max_rows and time each
+// stage of the pipeline over them: parse, YTM at the offering price by
+// MixedYTM(), both prices at that YTM and the durations; bonds without a
+// root are counted and left out of the later stages. The peak RSS
+// never drops, so each line shows the high-water mark reached by the end
+// of its stage.
+int Benchmark(size_t max_rows) {
+    cout << "Bond pipeline benchmark" << '\n';
+    cout << setw(10) << "rows" << setw(10) << "stage" << setw(12) << "seconds"
+         << setw(14) << "bonds/s" << setw(12) << "peak MB" << endl;
 
-        double omega_30360 = (180.0 - settle_30360) / 180.0;
-        // cout << "omega_30360: " << omega_30360 << endl;
+    for (size_t target = BENCH_MIN_ROWS; target <= max_rows; target *= 10) {
+        vector<BondRecord> records;
+        vector<int> periods, per_year;
+        vector<double> coupon, price, ytm;
+        size_t rows = 0;
+        bool ok = true;
+        auto stage = [&](const char* name, auto&& run) {
+            auto start = chrono::steady_clock::now();
+            run();
+            double seconds = chrono::duration<double>(
+                                 chrono::steady_clock::now() - start)
+                                 .count();
+            cout << setw(10) << rows << setw(10) << name << setprecision(4)
+                 << setw(12) << seconds << setprecision(0) << setw(14)
+                 << rows / max(seconds, 1e-9) << setprecision(1) << setw(12)
+                 << PeakRssMB() << endl;
+        };
 
-        double dirty_price_30360 = 0;
-        for (int j = 0; j < half_year_diff; j++) {
-            dirty_price_30360 +=
-                (rec.coupon / 2) / pow(1 + ytm / 2, j + omega_30360);
+        stage("generate",
+              [&] { rows = GenerateBonds(BENCH_FILE, target, false, 1); });
+        stage("parse", [&] {
+            ok = rows > 0 && ReadRecords(BENCH_FILE, records) &&
+                 records.size() == rows;
+        });
+        remove(BENCH_FILE);
+        if (!ok) {
+            cerr << "Cannot benchmark " << BENCH_FILE << endl;
+            return 1;
         }
-        dirty_price_30360 +=
-            100 / pow(1 + ytm / 2, half_year_diff - 1 + omega_30360);
-        cout << setw(20) << right << "Dirty Price:" << setw(10) << right
-             << dirty_price_30360 << endl;
 
-        double accrued_interest_30360 = rec.coupon / 2 * (1 - omega_30360);
-        double clean_price_30360 = dirty_price_30360 - accrued_interest_30360;
-        cout << setw(20) << right << "Clean Price:" << setw(10) << right
-             << clean_price_30360 << endl;
+        int fallbacks = 0;
+        stage("ytm", [&] {
+            // MixedYTM() on per-period inputs, then annual yields
+            periods.resize(rows);
+            per_year.resize(rows);
+            coupon.resize(rows);
+            price.resize(rows);
+            for (size_t i = 0; i < rows; i++) {
+                const BondRecord& rec = records[i];
+                DispatchFrequency(rec.frequency, [&](auto freq) {
+                    typedef decltype(freq) Freq;
+                    periods[i] =
+                        CouponPeriods<Freq>(rec.offering_date, rec.maturity);
+                    per_year[i] = Freq::per_year;
+                    coupon[i] = rec.coupon / Freq::per_year;
+                    price[i] = rec.offering_price;
+                });
+            }
+            fallbacks = MixedYTM(periods, coupon, price, ytm);
+            for (size_t i = 0; i < rows; i++) {
+                if (ytm[i] != -1) ytm[i] *= per_year[i];
+            }
+        });
+        size_t unsolved = count(ytm.begin(), ytm.end(), -1.0);
+        double checksum = 0, worst = 0;
+        stage("price", [&] {
+            for (size_t i = 0; i < rows; i++) {
+                if (ytm[i] == -1) continue;
+                DispatchFrequency(records[i].frequency, [&](auto freq) {
+                    typedef decltype(freq) Freq;
+                    double dirty[2], clean[2];
+                    DirtyCleanPrice<Freq, ActualActual>(
+                        records[i], periods[i], ytm[i], dirty[0], clean[0]);
+                    DirtyCleanPrice<Freq, Thirty360>(
+                        records[i], periods[i], ytm[i], dirty[1], clean[1]);
+                    checksum += clean[0] + clean[1];
+                });
+            }
+        });
+        stage("duration", [&] {
+            for (size_t i = 0; i < rows; i++) {
+                if (ytm[i] == -1) continue;
+                DispatchFrequency(records[i].frequency, [&](auto freq) {
+                    double macaulay, modified;
+                    Durations<decltype(freq)>(periods[i], records[i].coupon,
+                                              ytm[i], macaulay, modified);
+                    checksum += modified;
+                });
+            }
+        });
+        // the generated prices are rounded to 0.001, so the solved yields
+        // land within a few basis points of the offering yields
+        for (size_t i = 0; i < rows; i++) {
+            if (ytm[i] == -1) continue;
+            worst = max(worst, fabs(ytm[i] * 100 - records[i].offering_yield));
+        }
+        cout << setw(10) << rows << setw(10) << "check" << setprecision(6)
+             << "  max |YTM - yield| " << worst << "%, checksum " << checksum
+             << ", " << fallbacks - unsolved << " bisection fallbacks, "
+             << unsolved << " without a root" << endl;
     }
+    return 0;
+}
+
+int main(int argc, char* argv[]) {
+    cout << fixed << setprecision(5);
+
+    // --generate <file> <rows> [hw3] [seed]: write a synthetic universe
+    // --bench [max_rows]: time parse, YTM, prices and durations on such
+    if (argc > 3 && string(argv[1]) == "--generate") {
+        bool hw3_layout = argc > 4 && string(argv[4]) == "hw3";
+        uint64_t seed = argc > 5 ? strtoull(argv[5], nullptr, 10) : 1;
+        size_t rows = GenerateBonds(argv[2], strtoull(argv[3], nullptr, 10),
+                                    hw3_layout, seed);
+        cout << "Wrote " << rows << " bonds to " << argv[2] << endl;
+        return rows > 0 ? 0 : 1;
+    }
+    if (argc > 1 && string(argv[1]) == "--bench") {
+        return Benchmark(argc > 2 ? strtoull(argv[2], nullptr, 10)
+                                  : BENCH_MAX_ROWS);
+    }
+
+    vector<BondRecord> records;
+    if (!ReadRecords("qj2v53pmgqa0oh5p.csv", records)) {
+        return 1;
+    }
+
+    // curve-fitting mode: one NSS term structure per offering date
+    if (argc > 1 && string(argv[1]) == "--fit-curve") {
+        vector<FittedCurve> curves;
+        return FitCurves(records, curves);
+    }
+    // screening mode: float32 SIMD YTMs polished in double, checked
+    // against YTM()
+    if (argc > 1 && string(argv[1]) == "--mixed-ytm") {
+        return MixedYTMReport(records);
+    }
+    // service mode: keep the records and curves loaded, answer requests
+    if (argc > 2 && string(argv[1]) == "--serve") {
+        return Serve(argv[2], records);
+    }
+
+    // calculate the bond YTM, reusing the results of unchanged records;
+    // --drop-output drops reports rather than stall the pricing when the
+    // console falls behind
+    OutputPolicy policy = argc > 1 && string(argv[1]) == "--drop-output"
+                              ? OUTPUT_DROP
+                              : OUTPUT_BLOCK;
+    vector<CachedResult> results;
+    int reused =
+        PriceAndReport(records, LoadCache(CACHE_FILE), results, policy);
+    SaveCache(CACHE_FILE, results);
+    cout << "Reused " << reused << " of " << records.size()
+         << " results from " << CACHE_FILE << endl;
 
     return 0;
 }